@@ -21,7 +21,12 @@
 #include "utils/config.h"
 #include "utils/exception.h"
 #include "utils/log.h"
+#include "utils/misc.h"
 #include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <errno.h>
 
 using std::cout;
 using std::endl;
@@ -30,12 +35,24 @@ using namespace cdb;
 
 namespace lincore {
 
+static const int DEFAULT_SEND_BUFFER = 64 * 1024;
+
 void Client::init() 
 { 
     int testMode = 0;
     Config::instance().get("test", testMode);
     m_test = (testMode != 0);
 
+    int sendBuffer = DEFAULT_SEND_BUFFER;
+    Config::instance().get("send_buffer", sendBuffer);
+    if (sendBuffer <= 0) THROW("Invalid send_buffer");
+    m_flushSize = sendBuffer;
+    m_out.init(m_flushSize + 1);
+
+    int nodelay = 1;
+    Config::instance().get("tcp_nodelay", nodelay);
+    m_nodelay = (nodelay != 0);
+
     if (!m_test) {
         m_port = -1;
         Config::instance().get("host", m_host);
@@ -57,6 +74,12 @@ void Client::createSchema(list< MetricInfo >& info)
     send(cmd);
     cmd = string("create collection ") + m_dataspace + "." + m_collection + " with ifexists=ignore";
     send(cmd);
+    createMetrics(info);
+}
+
+void Client::createMetrics(list< MetricInfo >& info)
+{
+    string cmd;
     for (list< MetricInfo >::iterator iter = info.begin(); iter != info.end(); ++iter) {
         string metric = iter->m_name;
         string type = iter->m_type;
@@ -93,34 +116,67 @@ void Client::connect()
         }
         catch(Exception& e) {
             LOG_ERROR << "Failed to connect to " << m_host << ":" << m_port;
+            m_out.clear();
             throw;
         }
 
+        if (m_nodelay) setOption(TCP_NODELAY, true);
         m_connected = true;
     }
 }
 
-void Client::send(const string& line)
+void Client::disconnect()
+{
+    m_sock.disconnect();
+    m_connected = false;
+    m_out.clear();
+}
+
+void Client::setOption(int option, bool value)
+{
+    int flag = value ? 1 : 0;
+    if (setsockopt(m_sock.get(), IPPROTO_TCP, option, &flag, sizeof(flag)) != 0) {
+        LOG_WARN << "Failed to set TCP option " << option << ": " << getSystemError();
+    }
+}
+
+bool Client::send(const string& line)
 {
-    string fullCmd = line + "\n";
+    m_out.append(line.data(), line.length());
+    m_out.append("\n", 1);
+
+    if (m_out.length() < m_flushSize) return false;
+    flush();
+    return true;
+}
+
+void Client::flush()
+{
+    size_t length = m_out.length();
+    if (length == 0) return;
 
     if (m_test) {
-        cout << fullCmd;
+        cout.write(m_out.data(), length);
         cout.flush();
+        m_out.clear();
+        return;
     }
 
     connect();
 
-    try {
-        m_sock.send(fullCmd.c_str(), fullCmd.length());
-    }
-    catch(Exception& e) {
-        LOG_ERROR << "Failed to send data " << e.cause();
-        m_sock.disconnect();
-        m_connected = false;
-        throw;
+    const char* data = m_out.data();
+    while (length > 0) {
+        ssize_t ret = ::send(m_sock.get(), data, length, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR << "Failed to send data " << getSystemError();
+            disconnect();
+            THROW("Failed to send data");
+        }
+        data += ret;
+        length -= ret;
     }
+    m_out.clear();
 }
 
 } // namespace lincore
-
@@ -20,6 +20,7 @@
 #define CLIENT_H
 
 #include "metrics_data.h"
+#include "utils/buffer.h"
 #include "utils/sock.h"
 #include <string>
 #include <list>
@@ -29,17 +30,25 @@ using std::list;
 
 namespace lincore {
 
+/************************************
+ * Commands are collected in one output buffer and written out
+ * by flush(), or earlier once the buffer reaches send_buffer bytes.
+ ************************************/
 class Client
 {
 public:
-    Client() : m_connected(false), m_test(false) {}
+    Client() : m_connected(false), m_test(false), m_port(-1), m_flushSize(0),
+               m_nodelay(true) {}
 
     void init();
 
     void createSchema(list< MetricInfo >& info);
+    void createMetrics(list< MetricInfo >& info);
     void setStaticData(const string& data);
     void startStreaming(const string& header = "");
-    void send(const string& line);
+    // True if the line filled the buffer and everything up to it was written
+    bool send(const string& line);
+    void flush();
 
     string host() { return m_host; }
     short int port() { return m_port; }
@@ -52,9 +61,14 @@ private:
     string m_collection;
     string m_host;
     short  m_port;
+    cdb::Buffer m_out;
+    size_t m_flushSize;
+    bool   m_nodelay;
 
 private:
     void connect();
+    void disconnect();
+    void setOption(int option, bool value);
 
 };
 
@@ -0,0 +1,80 @@
+/**********************************************
+   File:   counter_store.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "counter_store.h"
+#include "simd_kernels.h"
+#include <algorithm>
+#include <stdint.h>
+
+namespace lincore {
+
+size_t CounterStore::add(size_t count)
+{
+    size_t slot = m_curr.size();
+    m_prev.resize(slot + count, 0);
+    m_curr.resize(slot + count, 0);
+    m_delta.resize(slot + count, 0);
+    return slot;
+}
+
+void CounterStore::prime()
+{
+    std::copy(m_curr.begin(), m_curr.end(), m_prev.begin());
+    std::fill(m_delta.begin(), m_delta.end(), 0);
+}
+
+void CounterStore::prime(size_t slot, size_t count)
+{
+    std::copy(m_curr.begin() + slot, m_curr.begin() + slot + count, m_prev.begin() + slot);
+    std::fill(m_delta.begin() + slot, m_delta.begin() + slot + count, 0);
+}
+
+CounterStore::Layout CounterStore::layout() const
+{
+    Layout layout = { 0, 0, m_curr.size() };
+    if (layout.m_size != 0) {
+        layout.m_curr = &m_curr[0];
+        layout.m_delta = &m_delta[0];
+    }
+    return layout;
+}
+
+double* CounterStore::rebase(double* p, const Layout& old)
+{
+    // Compared as integers, the old arrays may be gone already
+    uintptr_t address = (uintptr_t) p;
+    uintptr_t curr = (uintptr_t) old.m_curr;
+    uintptr_t delta = (uintptr_t) old.m_delta;
+    uintptr_t bytes = old.m_size * sizeof(double);
+
+    if ((address >= curr) && (address < curr + bytes)) {
+        return &m_curr[(address - curr) / sizeof(double)];
+    }
+    if ((address >= delta) && (address < delta + bytes)) {
+        return &m_delta[(address - delta) / sizeof(double)];
+    }
+    return p;
+}
+
+void CounterStore::update()
+{
+    if (m_curr.empty()) return;
+    counterDeltas(&m_curr[0], &m_prev[0], &m_delta[0], m_curr.size());
+}
+
+} // namespace lincore
@@ -0,0 +1,76 @@
+/**********************************************
+   File:   counter_store.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef COUNTER_STORE_H
+#define COUNTER_STORE_H
+
+#include <stddef.h>
+#include <vector>
+
+using std::vector;
+
+namespace lincore {
+
+/************************************
+ * Monotonic counters of every source in three parallel arrays:
+ * the previous reading, the current reading and the delta. A
+ * source reserves a block shaped like its struct of doubles and
+ * reads straight into curr(), one update() per tick then computes
+ * all deltas at once.
+ ************************************/
+class CounterStore
+{
+public:
+    // Reserve a block, returns its first slot. Pointers handed out
+    // before are invalid afterwards.
+    size_t add(size_t count);
+    template< typename T > size_t add() { return add(sizeof(T) / sizeof(double)); }
+
+    template< typename T > T* curr(size_t slot) { return reinterpret_cast< T* >(&m_curr[slot]); }
+    template< typename T > T* delta(size_t slot) { return reinterpret_cast< T* >(&m_delta[slot]); }
+
+    // Take the current readings as the baseline
+    void prime();
+    // Same for one block, e.g. a device seen for the first time
+    void prime(size_t slot, size_t count);
+    // delta = max(curr - prev, 0), prev = curr
+    void update();
+
+    size_t size() const { return m_curr.size(); }
+
+    // Where the arrays were, taken before add() to move pointers
+    // handed out earlier over to the new arrays with rebase()
+    struct Layout
+    {
+        const double* m_curr;
+        const double* m_delta;
+        size_t m_size;
+    };
+    Layout layout() const;
+    // Pointers outside of the store are returned as they are
+    double* rebase(double* p, const Layout& old);
+
+private:
+    vector< double > m_prev;
+    vector< double > m_curr;
+    vector< double > m_delta;
+};
+
+} // namespace lincore
+
+#endif // COUNTER_STORE_H
@@ -0,0 +1,166 @@
+/**********************************************
+   File:   device_watcher.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "device_watcher.h"
+#include "utils/exception.h"
+#include "utils/log.h"
+#include "utils/misc.h"
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace cdb;
+
+namespace lincore {
+
+static const size_t RECEIVE_BUFFER_SIZE = 16384;
+
+// Multicast group of the kernel uevents, udev re-broadcasts on 2
+static const unsigned int UEVENT_KERNEL_GROUP = 1;
+
+static int openSocket(int protocol, unsigned int groups)
+{
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, protocol);
+    if (fd < 0) return -1;
+
+    struct sockaddr_nl local;
+    memset(&local, 0, sizeof(local));
+    local.nl_family = AF_NETLINK;
+    local.nl_groups = groups;
+    if (bind(fd, (struct sockaddr*) &local, sizeof(local)) != 0) {
+        int error = errno;
+        ::close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+static void closeSocket(int& fd)
+{
+    if (fd < 0) return;
+    ::close(fd);
+    fd = -1;
+}
+
+DeviceWatcher::~DeviceWatcher()
+{
+    stop();
+}
+
+void DeviceWatcher::start(bool links, bool blocks)
+{
+    if (started()) return;
+
+    if (links) {
+        m_links = openSocket(NETLINK_ROUTE, RTMGRP_LINK);
+        if (m_links < 0) {
+            LOG_WARN << "Interface events are not available: " << getSystemError();
+        }
+    }
+
+    if (blocks) {
+        m_uevents = openSocket(NETLINK_KOBJECT_UEVENT, UEVENT_KERNEL_GROUP);
+        if (m_uevents < 0) {
+            LOG_WARN << "Block device events are not available: " << getSystemError();
+        }
+    }
+
+    if (!started()) THROW("Failed to open device event sockets");
+    m_buffer.resize(RECEIVE_BUFFER_SIZE);
+}
+
+void DeviceWatcher::stop()
+{
+    closeSocket(m_links);
+    closeSocket(m_uevents);
+}
+
+bool DeviceWatcher::poll(NetLinks& links)
+{
+    // Both sockets are drained even if the first one had news
+    bool added = drainLinks(links);
+    bool uevents = drainUevents();
+    return added || uevents;
+}
+
+bool DeviceWatcher::drainLinks(NetLinks& links)
+{
+    if (m_links < 0) return false;
+
+    bool changed = false;
+    for (;;) {
+        ssize_t n = recv(m_links, &m_buffer[0], m_buffer.size(), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == ENOBUFS) {
+                changed = true;
+                continue;
+            }
+            return changed;
+        }
+        if (n == 0) return changed;
+
+        size_t length = n;
+        struct nlmsghdr* header = (struct nlmsghdr*) &m_buffer[0];
+        for ( ; NLMSG_OK(header, length); header = NLMSG_NEXT(header, length)) {
+            if (header->nlmsg_type == RTM_DELLINK) {
+                changed = true;
+            }
+            else if (header->nlmsg_type == RTM_NEWLINK) {
+                struct ifinfomsg* info = (struct ifinfomsg*) NLMSG_DATA(header);
+                if (!links.contains(info->ifi_index)) changed = true;
+            }
+        }
+    }
+}
+
+bool DeviceWatcher::drainUevents()
+{
+    if (m_uevents < 0) return false;
+
+    bool changed = false;
+    for (;;) {
+        ssize_t n = recv(m_uevents, &m_buffer[0], m_buffer.size() - 1, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == ENOBUFS) {
+                changed = true;
+                continue;
+            }
+            return changed;
+        }
+        if (n == 0) return changed;
+
+        // "action@devpath" followed by KEY=value strings, all NUL-terminated
+        m_buffer[n] = '\0';
+        const char* p = &m_buffer[0];
+        const char* end = p + n;
+        bool block = false;
+        bool hotplug = (strncmp(p, "add@", 4) == 0) || (strncmp(p, "remove@", 7) == 0);
+        for ( ; p < end; p += strlen(p) + 1) {
+            if (strcmp(p, "SUBSYSTEM=block") == 0) block = true;
+        }
+        if (block && hotplug) changed = true;
+    }
+}
+
+} // namespace lincore
@@ -0,0 +1,68 @@
+/**********************************************
+   File:   device_watcher.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef DEVICE_WATCHER_H
+#define DEVICE_WATCHER_H
+
+#include "net_links.h"
+#include <stddef.h>
+#include <vector>
+
+using std::vector;
+
+namespace lincore {
+
+/************************************
+ * Listens for interfaces and block devices coming and going:
+ * RTM_NEWLINK/RTM_DELLINK on the rtnetlink link group and kernel
+ * uevents of the block subsystem. Both sockets are non-blocking
+ * and drained once per tick. RTM_NEWLINK also reports flag and
+ * address changes, so only an interface index missing from the
+ * last link dump counts; renames show in the dump generation.
+ ************************************/
+class DeviceWatcher
+{
+public:
+    DeviceWatcher() : m_links(-1), m_uevents(-1) {}
+    ~DeviceWatcher();
+
+    // Listens for the requested kinds, throws if none can be opened
+    void start(bool links, bool blocks);
+    void stop();
+    bool started() { return (m_links >= 0) || (m_uevents >= 0); }
+
+    // True if a device was added or removed since the last call.
+    // A lost event (receive buffer overrun) counts as a change.
+    bool poll(NetLinks& links);
+
+private:
+    int m_links;
+    int m_uevents;
+    vector< char > m_buffer;
+
+private:
+    DeviceWatcher(const DeviceWatcher&);
+    DeviceWatcher& operator=(const DeviceWatcher&);
+
+    bool drainLinks(NetLinks& links);
+    bool drainUevents();
+};
+
+} // namespace lincore
+
+#endif // DEVICE_WATCHER_H
@@ -0,0 +1,156 @@
+/**********************************************
+   File:   irq_stats.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "irq_stats.h"
+#include "proc_parse.h"
+#include "utils/exception.h"
+#include "utils/misc.h"
+#include <string.h>
+
+using namespace cdb;
+
+namespace lincore {
+
+// Newer kernels add the CPU of a softnet row as its 13th column
+static const int SOFTNET_CPU_COLUMN = 12;
+
+IrqTable::~IrqTable()
+{
+    for (size_t i=0; i < m_patterns.size(); i++) delete m_patterns[i];
+}
+
+void IrqTable::addGroup(const string& pattern)
+{
+    m_patterns.push_back(new Regex);
+    m_patterns.back()->compile(pattern);
+}
+
+void IrqTable::read(double* table, size_t cpus)
+{
+    if (!m_file.read()) THROW("Failed to read " + m_file.path() + ": " + getSystemError());
+
+    char* p = m_file.data();
+    char* line = nextLine(p);
+    size_t length = line - p;
+    if ((m_header.length() != length) || (memcmp(m_header.data(), p, length) != 0)) {
+        mapColumns(p, length);
+    }
+
+    for (size_t g=0; g < m_patterns.size(); g++) {
+        for (size_t c=0; c < m_columns.size(); c++) {
+            if ((size_t) m_columns[c] < cpus) table[g * cpus + m_columns[c]] = 0;
+        }
+    }
+
+    for (size_t index=0; *line; index++, line = nextLine(line)) {
+        char* label = skipBlanks(line);
+        char* colon = label;
+        while ((*colon != ':') && (*colon != '\n') && (*colon != '\0')) colon++;
+        if (*colon != ':') continue;
+
+        size_t labelLength = colon - label;
+        if (index == m_rows.size()) m_rows.push_back(Row());
+        Row& row = m_rows[index];
+        if ((row.m_label.length() != labelLength) ||
+            (memcmp(row.m_label.data(), label, labelLength) != 0)) {
+            mapRow(label, labelLength, colon + 1, row);
+        }
+        if (row.m_group < 0) continue;
+
+        double* sums = table + row.m_group * cpus;
+        char* v = colon + 1;
+        for (size_t c=0; c < m_columns.size(); c++) {
+            v = skipBlanks(v);
+            if (!isDigit(*v)) break;
+
+            unsigned long count;
+            v = parseNumber(v, count);
+            if ((size_t) m_columns[c] < cpus) sums[m_columns[c]] += count;
+        }
+    }
+}
+
+void IrqTable::mapColumns(const char* header, size_t length)
+{
+    m_header.assign(header, length);
+    m_columns.clear();
+
+    const char* end = header + length;
+    for (const char* p = header; p < end; p++) {
+        if ((p[0] != 'C') || (p + 3 >= end) || (p[1] != 'P') || (p[2] != 'U')) continue;
+        p += 3;
+        int cpu = 0;
+        for ( ; (p < end) && isDigit(*p); p++) cpu = cpu * 10 + (*p - '0');
+        m_columns.push_back(cpu);
+    }
+
+    // Columns moved, every row is mapped again
+    m_rows.clear();
+}
+
+void IrqTable::mapRow(char* label, size_t length, char* counts, Row& row)
+{
+    row.m_label.assign(label, length);
+    row.m_group = -1;
+
+    // The device is the last word after the counts
+    char* eol = strchr(counts, '\n');
+    string rest = (eol == NULL) ? string(counts) : string(counts, eol - counts);
+    size_t last = rest.find_last_not_of(" \t");
+    string device;
+    if (last != string::npos) {
+        size_t first = rest.find_last_of(" \t", last);
+        first = (first == string::npos) ? 0 : first + 1;
+        device = rest.substr(first, last - first + 1);
+    }
+
+    for (size_t g=0; g < m_patterns.size(); g++) {
+        if (m_patterns[g]->match(row.m_label) || (!device.empty() && m_patterns[g]->match(device))) {
+            row.m_group = (int) g;
+            break;
+        }
+    }
+}
+
+void SoftnetStat::read(double* table, size_t cpus)
+{
+    if (!m_file.read()) THROW("Failed to read " + m_file.path() + ": " + getSystemError());
+
+    char* p = m_file.data();
+    for (size_t row=0; *p; row++, p = nextLine(p)) {
+        unsigned long values[SOFTNET_CPU_COLUMN + 1];
+        int count = 0;
+        char* v = p;
+        for ( ; count <= SOFTNET_CPU_COLUMN; count++) {
+            v = skipBlanks(v);
+            if ((*v == '\n') || (*v == '\0')) break;
+            v = parseHex(v, values[count]);
+        }
+        if (count < SN_COUNT) continue;
+
+        // Older kernels list the online CPUs in order without their number
+        size_t cpu = (count > SOFTNET_CPU_COLUMN) ? values[SOFTNET_CPU_COLUMN] : row;
+        if (cpu >= cpus) continue;
+
+        table[SN_PROCESSED * cpus + cpu] = values[0];
+        table[SN_DROPPED * cpus + cpu] = values[1];
+        table[SN_SQUEEZED * cpus + cpu] = values[2];
+    }
+}
+
+} // namespace lincore
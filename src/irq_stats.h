@@ -0,0 +1,99 @@
+/**********************************************
+   File:   irq_stats.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef IRQ_STATS_H
+#define IRQ_STATS_H
+
+#include "proc_reader.h"
+#include "utils/regex_processor.h"
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace lincore {
+
+// Rows of the softnet table, in /proc/net/softnet_stat column order
+enum SoftnetField { SN_PROCESSED, SN_DROPPED, SN_SQUEEZED, SN_COUNT };
+
+/************************************
+ * /proc/interrupts or /proc/softirqs: a header of the online CPUs,
+ * then a row of per-CPU counts for every source. Rows add up into
+ * groups, a row joins the first group whose pattern matches its
+ * label or its device (the last word of the row).
+ *
+ * Which group a row belongs to is cached with its label, so on a
+ * tick the labels are compared and only the rows of a group are
+ * parsed; the rest is skipped to the end of the line. On hosts with
+ * hundreds of CPUs that skips most of the file.
+ ************************************/
+class IrqTable
+{
+public:
+    explicit IrqTable(const string& path) : m_file(path) {}
+    ~IrqTable();
+
+    void addGroup(const string& pattern);
+    size_t groups() { return m_patterns.size(); }
+
+    // Sums of group g on cpu c into table[g * cpus + c]. Offline CPUs
+    // are left alone. Throws if the file cannot be read.
+    void read(double* table, size_t cpus);
+
+private:
+    struct Row
+    {
+        string m_label;
+        int m_group;        // -1 if the row is skipped
+    };
+
+private:
+    ProcReader m_file;
+    vector< cdb::Regex* > m_patterns;
+    string m_header;
+    vector< int > m_columns;    // CPU of every column
+    vector< Row > m_rows;
+
+private:
+    IrqTable(const IrqTable&);
+    IrqTable& operator=(const IrqTable&);
+
+    void mapColumns(const char* header, size_t length);
+    void mapRow(char* label, size_t length, char* counts, Row& row);
+};
+
+/************************************
+ * /proc/net/softnet_stat, one row of hex counters per online CPU
+ ************************************/
+class SoftnetStat
+{
+public:
+    SoftnetStat() : m_file("/proc/net/softnet_stat") {}
+
+    // Field f of cpu c into table[f * cpus + c], throws if the file
+    // cannot be read
+    void read(double* table, size_t cpus);
+
+private:
+    ProcReader m_file;
+};
+
+} // namespace lincore
+
+#endif // IRQ_STATS_H
@@ -17,7 +17,8 @@
  **********************************************/
 
 #include "metrics_data.h"
-#include "client.h"
+#include "sender.h"
+#include "ticker.h"
 #include "utils/config.h"
 #include "utils/log.h"
 #include "utils/exception.h"
@@ -35,7 +36,8 @@ using namespace lincore;
 using namespace cdb;
 
 static MetricsData g_metricsData;
-static Client g_client;
+static Sender g_sender;
+static Ticker g_ticker;
 static const char* SIGNAL_MESSAGE = "lincore exit on signal\n";
 static const char* FILE_LOCK = "lincore.pid";
 static bool g_keepGoing = true;
@@ -46,27 +48,23 @@ static void signalHandler(int)
     g_keepGoing = false;
 }
 
-void doWork(list< MetricInfo >& info)
+void doWork()
 {
-    LOG_INFO << "Connecting to " << g_client.host() << ":" << g_client.port();
-
-    g_client.createSchema(info);
-
-    g_metricsData.collectInitial();
-    string staticMetrics = g_metricsData.getStaticMetrics();
-    if (!staticMetrics.empty()) {
-        g_client.setStaticData(staticMetrics);
-    }
-
-    g_client.startStreaming(g_metricsData.getStreamTitle());
-
+    g_ticker.start();
     while (g_keepGoing) {
-        sleep(1);
+        if (!g_ticker.wait()) continue;
         if (!g_keepGoing) break;
 
-        int t = (int) time(NULL);
-        g_metricsData.collect();
-        g_client.send(g_metricsData.getStreamMetrics(t));
+        g_metricsData.collect(g_ticker.ts(), g_ticker.prevTs());
+
+        list< MetricInfo > added;
+        if (g_metricsData.getSchemaChanges(added)) {
+            g_sender.updateSchema(added, g_metricsData.getStreamTitle());
+        }
+
+        size_t length;
+        const char* row = g_metricsData.getStreamMetrics(g_ticker.ts(), g_ticker.prevTs(), length);
+        g_sender.post(g_ticker.ts(), row, length);
     }
 }
 
@@ -86,21 +84,28 @@ void exceptionalMain(int argc, char* argv[])
     signal( SIGINT, signalHandler );
     signal( SIGTERM, signalHandler );
 
-    g_client.init();
+    g_sender.init();
+    g_ticker.init();
 
     list< MetricInfo > info;
     g_metricsData.init();
     g_metricsData.getMetricsInfo(info);
-    
+
+    g_metricsData.collectInitial();
+    g_sender.setSchema(info, g_metricsData.getStaticMetrics(), g_metricsData.getStreamTitle());
+    g_sender.start();
+
     while (g_keepGoing) {
         try {
-            doWork(info);
+            doWork();
         }
-        catch(Exception&) {
+        catch(Exception& e) {
+            LOG_ERROR << "Failed to collect metrics: " << e.cause();
             sleep(1);
         }
     }
 
+    g_sender.stop();
     g_metricsData.uninit();
 }
 
@@ -20,15 +20,23 @@
 #include "utils/config.h"
 #include "utils/exception.h"
 #include "utils/log.h"
-#include "utils/regex_processor.h"
+#include "utils/perf.h"
+#include "simd_kernels.h"
+#include "proc_backend.h"
+#include "proc_parse.h"
 #include <boost/algorithm/string.hpp>
-#include <iomanip>
+#include <algorithm>
 #include <iostream>
-#include <sstream>
 #include <vector>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
 
 using std::vector;
-using std::ostringstream;
 using std::cout;
 using std::endl;
 
@@ -36,246 +44,1296 @@ using namespace cdb;
 
 namespace lincore {
 
+const MetricTypeInfo METRIC_TYPES[MT_COUNT] = {
+    { "byte",   MetricTraits< MT_BYTE >::SIZE,   MetricTraits< MT_BYTE >::PRECISION },
+    { "short",  MetricTraits< MT_SHORT >::SIZE,  MetricTraits< MT_SHORT >::PRECISION },
+    { "int",    MetricTraits< MT_INT >::SIZE,    MetricTraits< MT_INT >::PRECISION },
+    { "float",  MetricTraits< MT_FLOAT >::SIZE,  MetricTraits< MT_FLOAT >::PRECISION },
+    { "double", MetricTraits< MT_DOUBLE >::SIZE, MetricTraits< MT_DOUBLE >::PRECISION }
+};
+
+#define FIELDS_COUNT(fields) (sizeof(fields) / sizeof(fields[0]))
+
+static const MetricField LAVG_FIELDS[] = {
+    METRIC_FIELD(LoadAverages, _1min,  "1min",  MT_SHORT, 1),
+    METRIC_FIELD(LoadAverages, _5min,  "5min",  MT_SHORT, 60),
+    METRIC_FIELD(LoadAverages, _15min, "15min", MT_SHORT, 300)
+};
+
+static const MetricField MEMORY_FIELDS[] = {
+    METRIC_FIELD(Memory, total, "total", MT_INT, 0),
+    METRIC_FIELD(Memory, used,  "used",  MT_INT, 1),
+    METRIC_FIELD(Memory, free,  "free",  MT_INT, 1)
+};
+
+// Counter blocks expose gauges from the current reading and
+// counters from the delta
+
+static const MetricField MEMORY_NATIVE_FIELDS[] = {
+    METRIC_FIELD(Memory, available, "available", MT_INT, 1),
+    METRIC_FIELD(Memory, dirty,     "dirty",     MT_INT, 1),
+    METRIC_FIELD(Memory, writeback, "writeback", MT_INT, 1)
+};
+
+static const MetricField SWAP_GAUGE_FIELDS[] = {
+    METRIC_FIELD(Swap, total,    "total",   MT_INT, 0),
+    METRIC_FIELD(Swap, used,     "used",    MT_INT, 1),
+    METRIC_FIELD(Swap, free,     "free",    MT_INT, 1)
+};
+
+static const MetricField SWAP_COUNTER_FIELDS[] = {
+    METRIC_FIELD(Swap, page_in,  "pageIn",  MT_INT, 1),
+    METRIC_FIELD(Swap, page_out, "pageOut", MT_INT, 1)
+};
+
+static const MetricField DISK_GAUGE_FIELDS[] = {
+    METRIC_FIELD(Disk, queue,      "queue",      MT_SHORT, 1)
+};
+
+static const MetricField DISK_TOTAL_FIELDS[] = {
+    METRIC_FIELD(Disk, reads,      "reads",      MT_SHORT, 1),
+    METRIC_FIELD(Disk, writes,     "writes",     MT_SHORT, 1),
+    METRIC_FIELD(Disk, readBytes,  "readBytes",  MT_INT,   1),
+    METRIC_FIELD(Disk, writeBytes, "writeBytes", MT_INT,   1),
+    METRIC_FIELD(Disk, readTime,   "readTime",   MT_SHORT, 1),
+    METRIC_FIELD(Disk, writeTime,  "writeTime",  MT_SHORT, 1),
+    METRIC_FIELD(Disk, totalTime,  "totalTime",  MT_SHORT, 1),
+    METRIC_FIELD(Disk, waitTime,   "waitTime",   MT_SHORT, 1),
+    METRIC_FIELD(Disk, discards,     "discards",     MT_SHORT, 1),
+    METRIC_FIELD(Disk, discardBytes, "discardBytes", MT_INT,   1),
+    METRIC_FIELD(Disk, discardTime,  "discardTime",  MT_SHORT, 1),
+    METRIC_FIELD(Disk, flushes,      "flushes",      MT_SHORT, 1),
+    METRIC_FIELD(Disk, flushTime,    "flushTime",    MT_SHORT, 1)
+};
+
+static const MetricField DISK_FIELDS[] = {
+    METRIC_FIELD(Disk, reads,      "reads",      MT_SHORT, 1),
+    METRIC_FIELD(Disk, writes,     "writes",     MT_SHORT, 1),
+    METRIC_FIELD(Disk, readBytes,  "readBytes",  MT_INT,   1),
+    METRIC_FIELD(Disk, writeBytes, "writeBytes", MT_INT,   1),
+    METRIC_FIELD(Disk, readTime,   "readTime",   MT_SHORT, 1),
+    METRIC_FIELD(Disk, writeTime,  "writeTime",  MT_SHORT, 1),
+    METRIC_FIELD(Disk, queueTime,  "queueTime",  MT_SHORT, 1),
+    METRIC_FIELD(Disk, totalTime,  "totalTime",  MT_SHORT, 1),
+    METRIC_FIELD(Disk, discards,     "discards",     MT_SHORT, 1),
+    METRIC_FIELD(Disk, discardBytes, "discardBytes", MT_INT,   1),
+    METRIC_FIELD(Disk, discardTime,  "discardTime",  MT_SHORT, 1),
+    METRIC_FIELD(Disk, flushes,      "flushes",      MT_SHORT, 1),
+    METRIC_FIELD(Disk, flushTime,    "flushTime",    MT_SHORT, 1)
+};
+
+static const MetricField CPU_FIELDS[] = {
+    METRIC_FIELD(CPUPercent, combined, "total",   MT_FLOAT, 1),
+    METRIC_FIELD(CPUPercent, user,     "user",    MT_FLOAT, 1),
+    METRIC_FIELD(CPUPercent, sys,      "system",  MT_FLOAT, 1),
+    METRIC_FIELD(CPUPercent, nice,     "nice",    MT_FLOAT, 1),
+    METRIC_FIELD(CPUPercent, idle,     "idle",    MT_FLOAT, 1),
+    METRIC_FIELD(CPUPercent, wait,     "wait",    MT_FLOAT, 1),
+    METRIC_FIELD(CPUPercent, irq,      "irq",     MT_FLOAT, 1),
+    METRIC_FIELD(CPUPercent, softIrq,  "softIrq", MT_FLOAT, 1),
+    METRIC_FIELD(CPUPercent, stolen,   "stolen",  MT_FLOAT, 1)
+};
+
+static const MetricField CPU_NATIVE_FIELDS[] = {
+    METRIC_FIELD(CPUPercent, guest,     "guest",     MT_FLOAT, 1),
+    METRIC_FIELD(CPUPercent, guestNice, "guestNice", MT_FLOAT, 1)
+};
+
+static const MetricField CPU_SUMMARY_FIELDS[] = {
+    METRIC_FIELD(CPUSummary, busyMax,  "busyMax",  MT_FLOAT, 1),
+    METRIC_FIELD(CPUSummary, busyP90,  "busyP90",  MT_FLOAT, 1),
+    METRIC_FIELD(CPUSummary, busyOver, "busyOver", MT_SHORT, 1)
+};
+
+static const MetricField SCHED_FIELDS[] = {
+    METRIC_FIELD(SchedSummary, runDelay,      "runDelay",      MT_INT,   1),
+    METRIC_FIELD(SchedSummary, runDelayMax,   "runDelayMax",   MT_INT,   1),
+    METRIC_FIELD(SchedSummary, timeslices,    "timeslices",    MT_INT,   1),
+    METRIC_FIELD(SchedSummary, delayPerSlice, "delayPerSlice", MT_FLOAT, 1)
+};
+
+// Per-CPU columns, rows of the percent table
+static const struct {
+    PerCPUField m_field;
+    const char* m_name;
+} PER_CPU_COLUMNS[] = {
+    { PC_USER,    "user" },
+    { PC_SYSTEM,  "system" },
+    { PC_WAIT,    "wait" },
+    { PC_IRQ,     "irq" },
+    { PC_SOFTIRQ, "softIrq" },
+    { PC_STOLEN,  "stolen" }
+};
+
+static const MetricField PROCESS_FIELDS[] = {
+    METRIC_FIELD(ProcessCount, total,   "process_count", MT_SHORT, 1),
+    METRIC_FIELD(ProcessCount, threads, "thread_count",  MT_SHORT, 1)
+};
+
+static const MetricField PROCESS_NATIVE_FIELDS[] = {
+    METRIC_FIELD(ProcessCount, running, "process_running", MT_SHORT, 1),
+    METRIC_FIELD(ProcessCount, blocked, "process_blocked", MT_SHORT, 1)
+};
+
+// Rate comes from process_states
+static const MetricField PROCESS_STATE_FIELDS[] = {
+    METRIC_FIELD(ProcessStates, running,   "running",   MT_SHORT, 0),
+    METRIC_FIELD(ProcessStates, sleeping,  "sleeping",  MT_SHORT, 0),
+    METRIC_FIELD(ProcessStates, diskSleep, "diskSleep", MT_SHORT, 0),
+    METRIC_FIELD(ProcessStates, zombie,    "zombie",    MT_SHORT, 0),
+    METRIC_FIELD(ProcessStates, stopped,   "stopped",   MT_SHORT, 0),
+    METRIC_FIELD(ProcessStates, idle,      "idle",      MT_SHORT, 0)
+};
+
+static const MetricField WATCH_FIELDS[] = {
+    METRIC_FIELD(WatchMetrics, pid,         "pid",         MT_INT,   1),
+    METRIC_FIELD(WatchMetrics, cpu,         "cpu",         MT_FLOAT, 1),
+    METRIC_FIELD(WatchMetrics, rss,         "rss",         MT_INT,   1),
+    METRIC_FIELD(WatchMetrics, pss,         "pss",         MT_INT,   1),
+    METRIC_FIELD(WatchMetrics, majorFaults, "majorFaults", MT_INT,   1),
+    METRIC_FIELD(WatchMetrics, ctxSwitches, "ctxSwitches", MT_INT,   1),
+    METRIC_FIELD(WatchMetrics, fds,         "fds",         MT_INT,   1),
+    METRIC_FIELD(WatchMetrics, readBytes,   "readBytes",   MT_INT,   1),
+    METRIC_FIELD(WatchMetrics, writeBytes,  "writeBytes",  MT_INT,   1)
+};
+
+static const MetricField TCP_FIELDS[] = {
+    METRIC_FIELD(Tcp, connOpens,   "open",  MT_INT, 1),
+    METRIC_FIELD(Tcp, connFailed,  "fail",  MT_INT, 1),
+    METRIC_FIELD(Tcp, connections, "count", MT_INT, 1),
+    METRIC_FIELD(Tcp, inSeg,       "recv",  MT_INT, 1),
+    METRIC_FIELD(Tcp, outSeg,      "sent",  MT_INT, 1),
+    METRIC_FIELD(Tcp, retransmits, "retr",  MT_INT, 1)
+};
+
+static const MetricField TCP_STATE_FIELDS[] = {
+    METRIC_FIELD(TcpStates, established, "established", MT_INT, 1),
+    METRIC_FIELD(TcpStates, synSent,     "synSent",     MT_INT, 1),
+    METRIC_FIELD(TcpStates, synRecv,     "synRecv",     MT_INT, 1),
+    METRIC_FIELD(TcpStates, finWait1,    "finWait1",    MT_INT, 1),
+    METRIC_FIELD(TcpStates, finWait2,    "finWait2",    MT_INT, 1),
+    METRIC_FIELD(TcpStates, timeWait,    "timeWait",    MT_INT, 1),
+    METRIC_FIELD(TcpStates, closed,      "closed",      MT_INT, 1),
+    METRIC_FIELD(TcpStates, closeWait,   "closeWait",   MT_INT, 1),
+    METRIC_FIELD(TcpStates, lastAck,     "lastAck",     MT_INT, 1),
+    METRIC_FIELD(TcpStates, listen,      "listen",      MT_INT, 1),
+    METRIC_FIELD(TcpStates, closing,     "closing",     MT_INT, 1)
+};
+
+static const MetricField TCP_HISTOGRAM_FIELDS[] = {
+    METRIC_FIELD(TcpHistogram, rtt1ms,         "rtt1ms",         MT_INT, 1),
+    METRIC_FIELD(TcpHistogram, rtt10ms,        "rtt10ms",        MT_INT, 1),
+    METRIC_FIELD(TcpHistogram, rtt100ms,       "rtt100ms",       MT_INT, 1),
+    METRIC_FIELD(TcpHistogram, rtt1s,          "rtt1s",          MT_INT, 1),
+    METRIC_FIELD(TcpHistogram, rttOver,        "rttOver",        MT_INT, 1),
+    METRIC_FIELD(TcpHistogram, retransmitting, "retransmitting", MT_INT, 1),
+    METRIC_FIELD(TcpHistogram, retrans1,       "retrans1",       MT_INT, 1),
+    METRIC_FIELD(TcpHistogram, retrans10,      "retrans10",      MT_INT, 1),
+    METRIC_FIELD(TcpHistogram, retrans100,     "retrans100",     MT_INT, 1)
+};
+
+static const MetricField TCP_PORT_FIELDS[] = {
+    METRIC_FIELD(TcpPort, acceptQueue, "acceptQueue", MT_INT, 1),
+    METRIC_FIELD(TcpPort, backlog,     "backlog",     MT_INT, 1)
+};
+
+static const MetricField TCPEXT_FIELDS[] = {
+    METRIC_FIELD(NetStack, listenOverflows, "listenOverflows", MT_INT, 1),
+    METRIC_FIELD(NetStack, listenDrops,     "listenDrops",     MT_INT, 1),
+    METRIC_FIELD(NetStack, backlogDrop,     "backlogDrop",     MT_INT, 1),
+    METRIC_FIELD(NetStack, pruneCalled,     "pruneCalled",     MT_INT, 1),
+    METRIC_FIELD(NetStack, rcvPruned,       "rcvPruned",       MT_INT, 1),
+    METRIC_FIELD(NetStack, timeouts,        "timeouts",        MT_INT, 1),
+    METRIC_FIELD(NetStack, synRetrans,      "synRetrans",      MT_INT, 1),
+    METRIC_FIELD(NetStack, syncookiesSent,  "syncookiesSent",  MT_INT, 1),
+    METRIC_FIELD(NetStack, abortOnMemory,   "abortOnMemory",   MT_INT, 1),
+    METRIC_FIELD(NetStack, reqQFullDrop,    "reqQFullDrop",    MT_INT, 1)
+};
+
+static const MetricField IPEXT_FIELDS[] = {
+    METRIC_FIELD(NetStack, inNoRoutes,      "inNoRoutes",      MT_INT, 1),
+    METRIC_FIELD(NetStack, inTruncatedPkts, "inTruncatedPkts", MT_INT, 1),
+    METRIC_FIELD(NetStack, ipInCsumErrors,  "inCsumErrors",    MT_INT, 1)
+};
+
+static const MetricField TCP_SNMP_FIELDS[] = {
+    METRIC_FIELD(NetStack, tcpInErrs,  "inErrs",  MT_INT, 1),
+    METRIC_FIELD(NetStack, tcpOutRsts, "outRsts", MT_INT, 1)
+};
+
+static const MetricField UDP_FIELDS[] = {
+    METRIC_FIELD(NetStack, udpInDatagrams,  "inDatagrams",  MT_INT, 1),
+    METRIC_FIELD(NetStack, udpOutDatagrams, "outDatagrams", MT_INT, 1),
+    METRIC_FIELD(NetStack, udpNoPorts,      "noPorts",      MT_INT, 1),
+    METRIC_FIELD(NetStack, udpInErrors,     "inErrors",     MT_INT, 1),
+    METRIC_FIELD(NetStack, udpRcvbufErrors, "rcvbufErrors", MT_INT, 1),
+    METRIC_FIELD(NetStack, udpSndbufErrors, "sndbufErrors", MT_INT, 1)
+};
+
+static const MetricField IRQ_ROLLUP_FIELDS[] = {
+    METRIC_FIELD(IrqRollup, total, "total", MT_INT,   1),
+    METRIC_FIELD(IrqRollup, max,   "max",   MT_INT,   1),
+    METRIC_FIELD(IrqRollup, cpus,  "cpus",  MT_SHORT, 1)
+};
+
+// Indexed by IrqKind
+static const char* IRQ_PREFIXES[IK_COUNT] = { "softnet_", "irq_", "softirq_" };
+
+// Indexed by SoftnetField
+static const char* SOFTNET_GROUPS[SN_COUNT] = { "processed", "dropped", "squeezed" };
+
+static const MetricField NET_FIELDS[] = {
+    METRIC_FIELD(NetMetrics, rxPackets,  "rxPackets",  MT_INT, 1),
+    METRIC_FIELD(NetMetrics, rxBytes,    "rxBytes",    MT_INT, 1),
+    METRIC_FIELD(NetMetrics, rxErrors,   "rxErrors",   MT_INT, 1),
+    METRIC_FIELD(NetMetrics, rxDropped,  "rxDropped",  MT_INT, 1),
+    METRIC_FIELD(NetMetrics, rxOverruns, "rxOverruns", MT_INT, 1),
+    METRIC_FIELD(NetMetrics, txPackets,  "txPackets",  MT_INT, 1),
+    METRIC_FIELD(NetMetrics, txBytes,    "txBytes",    MT_INT, 1),
+    METRIC_FIELD(NetMetrics, txErrors,   "txErrors",   MT_INT, 1),
+    METRIC_FIELD(NetMetrics, txDropped,  "txDropped",  MT_INT, 1),
+    METRIC_FIELD(NetMetrics, txOverruns, "txOverruns", MT_INT, 1)
+};
+
+static const MetricField FS_FIELDS[] = {
+    METRIC_FIELD(FSInfo, totalSpace,  "total",       MT_INT,  0),
+    METRIC_FIELD(FSInfo, usedPercent, "usedPercent", MT_BYTE, 10),
+    METRIC_FIELD(FSInfo, freeSpace,   "free",        MT_INT,  10),
+    METRIC_FIELD(FSInfo, usedSpace,   "used",        MT_INT,  10),
+    METRIC_FIELD(FSInfo, availSpace,  "avail",       MT_INT,  10)
+};
+
+// Rate comes from top_rate, io only with top_by=...,io
+static const MetricField TOP_FIELDS[] = {
+    METRIC_FIELD(TopEntry, pid, "pid", MT_INT,   0),
+    METRIC_FIELD(TopEntry, cpu, "cpu", MT_FLOAT, 0),
+    METRIC_FIELD(TopEntry, rss, "rss", MT_INT,   0),
+    METRIC_FIELD(TopEntry, io,  "io",  MT_INT,   0)
+};
+
+static const char* const TOP_NAMES[TOP_COUNT] = { "cpu", "rss", "io" };
+
+// Rate comes from top_rate, io only with apps_io
+static const MetricField APP_FIELDS[] = {
+    METRIC_FIELD(GroupUsage, processes,   "processes",   MT_INT,   0),
+    METRIC_FIELD(GroupUsage, cpu,         "cpu",         MT_FLOAT, 0),
+    METRIC_FIELD(GroupUsage, rss,         "rss",         MT_INT,   0),
+    METRIC_FIELD(GroupUsage, majorFaults, "majorFaults", MT_INT,   0),
+    METRIC_FIELD(GroupUsage, io,          "io",          MT_INT,   0)
+};
+
+// Sorts the groups found at startup, the largest first
+struct LargerGroup
+{
+    bool operator()(const GroupTotals::value_type* left, const GroupTotals::value_type* right) const {
+        return left->second.rss > right->second.rss;
+    }
+};
+
+static const size_t DISK_BLOCK = sizeof(Disk) / sizeof(double);
+static const size_t NET_BLOCK = sizeof(NetMetrics) / sizeof(double);
+static const size_t WATCH_BLOCK = sizeof(ProcessUsage) / sizeof(double);
+
+static const int DEFAULT_WORKERS = 2;
+static const int DEFAULT_BUSY_THRESHOLD = 90;
+static const int DEFAULT_COLLECT_TIMEOUT_MS = 300;
+static const int DEFAULT_WATCH_RESCAN = 10;
+static const int DEFAULT_TOP_RATE = 10;
+static const int DEFAULT_TOP_THREADS = 2;
+static const int DEFAULT_TOP_TIMEOUT_MS = 10000;
+static const int DEFAULT_APPS_MAX = 20;
+static const int MIN_BACKOFF = 10;
+static const int MAX_BACKOFF = 600;
+
+// Every double of a struct to NaN, which leaves the fields empty
+static void blank(void* data, size_t size)
+{
+    double* fields = (double*) data;
+    for (size_t i=0; i < size / sizeof(double); i++) fields[i] = NAN;
+}
+
+/************************************
+ * statvfs of one mount, a dead NFS server can block it forever
+ ************************************/
+class FSJob : public SourceJob
+{
+public:
+    explicit FSJob(Mount& mount) : m_mount(mount), m_path(mount.m_name) {}
+
+    virtual void run() {
+        try {
+            SigarIface::getFS(m_path, m_result);
+            m_ok = true;
+        }
+        catch(...) {
+            m_ok = false;
+        }
+    }
+
+    virtual string name() {
+        return "fs " + m_path;
+    }
+
+    virtual void publish() {
+        m_mount.m_info = m_result;
+    }
+
+    virtual void invalidate() {
+        double nan = NAN;
+        m_mount.m_info.usedPercent = nan;
+        m_mount.m_info.freeSpace = nan;
+        m_mount.m_info.usedSpace = nan;
+        m_mount.m_info.availSpace = nan;
+    }
+
+private:
+    Mount& m_mount;         // only for the collector, a stuck job may outlive it
+    string m_path;
+    FSInfo m_result;
+};
+
+/************************************
+ * inet_diag dump of every TCP socket, long on hosts with many
+ ************************************/
+class TcpDiagJob : public SourceJob
+{
+public:
+    // Takes the diag over, a stuck job keeps it to itself
+    TcpDiagJob(SockDiag* diag, TcpStates& states, TcpHistogram& histogram, vector< TcpPort >& ports)
+        : m_diag(diag), m_states(states), m_histogram(histogram), m_ports(ports) {}
+    virtual ~TcpDiagJob() { delete m_diag; }
+
+    virtual void run() {
+        try {
+            m_diag->dump();
+            m_ok = true;
+        }
+        catch(...) {
+            m_ok = false;
+        }
+    }
+
+    virtual string name() {
+        return "tcp sockets";
+    }
+
+    virtual void publish() {
+        m_states = m_diag->states();
+        m_histogram = m_diag->histogram();
+        for (size_t i=0; i < m_ports.size(); i++) m_ports[i] = m_diag->port(i);
+    }
+
+    virtual void invalidate() {
+        blank(&m_states, sizeof(m_states));
+        blank(&m_histogram, sizeof(m_histogram));
+        for (size_t i=0; i < m_ports.size(); i++) blank(&m_ports[i], sizeof(m_ports[i]));
+    }
+
+private:
+    SockDiag* m_diag;       // only the worker touches it while in flight
+    TcpStates& m_states;
+    TcpHistogram& m_histogram;
+    vector< TcpPort >& m_ports;
+};
+
+/************************************
+ * One pass over /proc for the top_* and app_* metrics. With many
+ * processes it takes longer than a tick, so the source is deferred:
+ * a pass is published on the next tick the source is due.
+ ************************************/
+class ProcessScanJob : public SourceJob
+{
+public:
+    ProcessScanJob(ProcessScanner& scanner, int timeoutMs, const bool* kinds, size_t count,
+                   vector< TopEntry >& top, const AppSlots& slots, vector< GroupUsage >& apps,
+                   size_t& pick, vector< string >& picked)
+        : m_scanner(scanner), m_timeoutMs(timeoutMs), m_kinds(kinds), m_count(count),
+          m_top(top), m_slots(slots), m_apps(apps), m_pick(pick), m_picked(picked) {}
+
+    virtual void run() {
+        try {
+            m_ok = m_scanner.scan(m_timeoutMs);
+        }
+        catch(...) {
+            m_ok = false;
+        }
+    }
+
+    virtual string name() {
+        return "process scan";
+    }
+
+    virtual void publish() {
+        for (int kind=0; kind < TOP_COUNT; kind++) {
+            if (m_kinds[kind]) m_scanner.getTop((TopKind) kind, &m_top[kind * m_count]);
+        }
+        if (m_apps.empty()) return;
+
+        // The groups without a column of their own go to other, the first one
+        m_apps.assign(m_apps.size(), GroupUsage());
+        const GroupTotals& groups = m_scanner.getGroups();
+        if (m_pick != 0) pick(groups);
+        for (GroupTotals::const_iterator it = groups.begin(); it != groups.end(); ++it) {
+            AppSlots::const_iterator slot = m_slots.find(it->first);
+            GroupUsage& app = m_apps[(slot != m_slots.end()) ? slot->second : 0];
+            app.processes += it->second.processes;
+            app.cpu += it->second.cpu;
+            app.rss += it->second.rss;
+            app.majorFaults += it->second.majorFaults;
+            app.io += it->second.io;
+        }
+    }
+
+    virtual void invalidate() {
+        if (!m_top.empty()) blank(&m_top[0], m_top.size() * sizeof(TopEntry));
+        if (!m_apps.empty()) blank(&m_apps[0], m_apps.size() * sizeof(GroupUsage));
+    }
+
+private:
+    ProcessScanner& m_scanner;  // only the worker touches it while in flight
+    int m_timeoutMs;
+    const bool* m_kinds;
+    size_t m_count;
+    vector< TopEntry >& m_top;
+    const AppSlots& m_slots;
+    vector< GroupUsage >& m_apps;
+    size_t& m_pick;             // groups to get columns after this pass
+    vector< string >& m_picked;
+
+    // The largest groups by rss, the collector adds their columns
+    void pick(const GroupTotals& groups) {
+        vector< const GroupTotals::value_type* > sorted;
+        for (GroupTotals::const_iterator it = groups.begin(); it != groups.end(); ++it) {
+            if (it->first != "other") sorted.push_back(&*it);
+        }
+        std::sort(sorted.begin(), sorted.end(), LargerGroup());
+        for (size_t i=0; (i < sorted.size()) && (i < m_pick); i++) {
+            m_picked.push_back(sorted[i]->first);
+        }
+        m_pick = 0;
+    }
+};
+
+static bool metricLess(const Metric& a, const Metric& b)
+{
+    return strcmp(a.m_name, b.m_name) < 0;
+}
+
+static bool metricSame(const Metric& a, const Metric& b)
+{
+    return strcmp(a.m_name, b.m_name) == 0;
+}
+
+static void freePatterns(list< Regex* >& patterns)
+{
+    list< Regex* >::iterator iter = patterns.begin();
+    for (; iter != patterns.end(); ++iter) delete *iter;
+    patterns.clear();
+}
+
 MetricsData::~MetricsData()
 {
-    map< string, Disk* >::iterator iter = m_disks.begin();
-    for ( ; iter != m_disks.end(); ++iter) delete iter->second;
+    m_pool.stop();
+
+    // A job still in flight belongs to a stuck worker, and so does
+    // the scanner a scan job or a shard of it is still reading
+    bool scanning = false;
+    for (size_t i=0; i < m_sources.size(); i++) {
+        if (!m_sources[i].m_inFlight) delete m_sources[i].m_job;
+        else if ((m_scanner != 0) && (i == m_scanSource)) scanning = true;
+    }
+    if ((m_scanner != 0) && !scanning && !m_scanner->busy()) delete m_scanner;
 
-    map< string, NetMetrics* >::iterator jter = m_nets.begin();
-    for ( ; jter != m_nets.end(); ++jter) delete jter->second;
+    for (size_t i=0; i < m_watches.size(); i++) delete m_watches[i].m_probe;
 
-    map< string, FSInfo* >::iterator kter = m_fs.begin();
-    for ( ; kter != m_fs.end(); ++kter) delete kter->second;
+    freePatterns(m_diskPatterns);
+    freePatterns(m_netPatterns);
+    freePatterns(m_filters);
 }
 
 void MetricsData::init()
 {
     LOG_INFO << "Initializing MetricsData";
 
+    // native adds columns, so it is only used when asked for
+    string backend = "sigar";
+    Config::instance().get("backend", backend);
+    if ((backend != "native") && (backend != "sigar")) THROW("Invalid backend: " + backend);
+    m_sigar.setNative(backend == "native");
     m_sigar.init();
+    LOG_INFO << "CPU, memory, swap and load from " << backend << " backend";
 
+    m_swap = m_counters.add< Swap >();
+    m_disk = m_counters.add< Disk >();
     fillDisks();
     fillNets();
     fillFS();
+    fillPerCPU();
+    fillSchedStat();
+    fillWatches();
+    fillTop();
+    fillApps();
+    startScanner();
+    fillNetStack();
+    fillTcpDiag();
+    fillIrqs();
+    LOG_INFO << "Counters: " << m_counters.size() << ", delta kernel: " << simdLevel();
     
     fillMetrics();
+    sortMetrics();
     calcSize();
     filterMetrics();
+    buildPlan();
+    compileRow();
+    startPool();
+    startWatcher();
 }
 
 void MetricsData::uninit()
 {
+    m_watcher.stop();
+    m_pool.stop();
+    if (m_scanner != 0) m_scanner->stop();
     m_sigar.uninit();
 }
 
 void MetricsData::getMetricsInfo(list< MetricInfo >& info)
 {
-    MetricsMap::iterator iter = m_metrics.begin();
+    MetricsList::iterator iter = m_metrics.begin();
     for ( ; iter != m_metrics.end(); ++iter) {
-        MetricInfo mi = { iter->first, iter->second.m_type };
+        MetricInfo mi = { iter->m_name, METRIC_TYPES[iter->m_type].m_name };
         info.push_back(mi);
     }
 }
 
+bool MetricsData::getSchemaChanges(list< MetricInfo >& added)
+{
+    if (m_added.empty()) return false;
+    added.splice(added.end(), m_added);
+    return true;
+}
+
 string MetricsData::getStreamTitle()
 {
-    ostringstream ostr;
+    string title;
 
-    MetricsMap::iterator iter = m_metrics.begin();
+    MetricsList::iterator iter = m_metrics.begin();
     for (int i=0; iter != m_metrics.end(); ++iter) {
-        if (iter->second.m_rate == 0) continue;
+        if (iter->m_rate == 0) continue;
 
-        if (i != 0) ostr << ", ";
+        if (i != 0) title += ", ";
         i++;
 
-        ostr << iter->first << "=?";
+        title += iter->m_name;
+        title += "=?";
     }
 
-    return ostr.str();
+    return title;
 }
 
-string MetricsData::getStreamMetrics(int ts)
+const char* MetricsData::getStreamMetrics(int ts, int prevTs, size_t& length)
 {
-    ostringstream ostr;
-    ostr << "_";
+    return m_row.format(ts, prevTs, length);
+}
 
-    MetricsMap::iterator iter = m_metrics.begin();
-    for ( ; iter != m_metrics.end(); ++iter) {
-        if (iter->second.m_rate == 0) continue;
+string MetricsData::getStaticMetrics()
+{
+    string result;
+    char buf[RowFormatter::MAX_FIELD_WIDTH];
+
+    MetricsList::iterator iter = m_metrics.begin();
+    for (int i=0; iter != m_metrics.end(); ++iter) {
+        if (iter->m_rate != 0) continue;
 
-        ostr << ",";
-        if (ts % iter->second.m_rate != 0) continue;
+        if (i != 0) result += ", ";
+        i++;
+
+        char* end = formatFixed(buf, *iter->m_data, METRIC_TYPES[iter->m_type].m_precision);
+        result += iter->m_name;
+        result += "=";
+        result.append(buf, end - buf);
+    }
 
-        if (iter->second.m_integer) 
-            ostr << std::fixed << std::setprecision(0);
+    return result;
+}
+
+void MetricsData::collectInitial()
+{
+    // Baselines for the counters and values of the static metrics
+    int ts = (int) time(NULL);
+    m_sigar.nextTick();
+    for (size_t i=0; i < m_sources.size(); i++) {
+        if (!m_sources[i].m_used) continue;
+        if (m_sources[i].m_job == 0)
+            read(i);
         else
-            ostr << std::fixed << std::setprecision(2);
+            submit(i, ts);
+    }
+    waitJobs(ts, true);
+    m_counters.prime();
+
+    for (size_t i=0; i < m_sources.size(); i++) m_sources[i].m_read = false;
+}
+
+void MetricsData::collect(int ts, int prevTs)
+{
+    m_sigar.nextTick();
+
+    if (m_watcher.started() && m_watcher.poll(m_links)) m_rescan = true;
+    if (m_rescan) discover();
+    if (!m_appsPicked.empty()) addApps();
+
+    for (size_t i=0; i < m_plan.size(); i++) {
+        const RateGroup& group = m_plan[i];
+        if (ts / group.m_rate == prevTs / group.m_rate) continue;
+
+        for (size_t j=0; j < group.m_sources.size(); j++) {
+            m_sources[group.m_sources[j]].m_due = true;
+        }
+    }
+
+    // Blocking sources first, they run while the rest is read
+    for (size_t i=0; i < m_sources.size(); i++) {
+        if (!m_sources[i].m_due || (m_sources[i].m_job == 0)) continue;
+        m_sources[i].m_due = false;
+        submit(i, ts);
+    }
 
-        ostr << *iter->second.m_data;
+    for (size_t i=0; i < m_sources.size(); i++) {
+        if (!m_sources[i].m_due) continue;
+        m_sources[i].m_due = false;
+        read(i);
     }
 
-    return ostr.str();
+    waitJobs(ts, false);
+
+    // Counters not read this tick keep prev == curr, the next
+    // reading then gives the delta over the whole interval
+    m_counters.update();
+    derive();
 }
 
-string MetricsData::getStaticMetrics()
+void MetricsData::read(size_t source)
 {
-    ostringstream ostr;
-    ostr << std::fixed << std::setprecision(2);
+    Source& s = m_sources[source];
+    (this->*s.m_reader)(s.m_arg);
+    s.m_read = true;
+}
 
-    MetricsMap::iterator iter = m_metrics.begin();
-    for (int i=0; iter != m_metrics.end(); ++iter) {
-        if (iter->second.m_rate != 0) continue;
+void MetricsData::derive()
+{
+    for (size_t i=0; i < m_sources.size(); i++) {
+        Source& s = m_sources[i];
+        if (!s.m_read) continue;
+        s.m_read = false;
+        if (s.m_derive != 0) (this->*s.m_derive)(s.m_arg);
+    }
+}
 
-        if (i != 0) ostr << ", ";
-        i++;
-        
-        if (iter->second.m_integer) 
-            ostr << std::fixed << std::setprecision(0);
+void MetricsData::submit(size_t source, int ts)
+{
+    Source& s = m_sources[source];
+    if (s.m_deferred) {
+        // The pass that finished since the last due tick, if any. One
+        // still running is published on the next due tick after it ends.
+        if (s.m_ready)
+            s.m_job->publish();
         else
-            ostr << std::fixed << std::setprecision(2);
-
-        ostr << iter->first << "=" << *iter->second.m_data;
+            s.m_job->invalidate();
+        s.m_ready = false;
+        if (s.m_inFlight) return;
+    }
+    if (s.m_inFlight) {
+        // Never queue a second reading behind a stuck one
+        missed(source, ts, "previous reading still in flight");
+        return;
+    }
+    if (ts < s.m_retryAt) {
+        s.m_job->invalidate();
+        return;
     }
 
-    return ostr.str();
+    s.m_inFlight = true;
+    s.m_submitted = ts;
+    if (!m_pool.submit(s.m_job)) {
+        s.m_inFlight = false;
+        missed(source, ts, "worker queue is full");
+    }
 }
 
-void MetricsData::collectInitial()
+void MetricsData::waitJobs(int ts, bool initial)
 {
-    int cores;
-    m_sigar.getCpuCores(cores);
-    m_coresCount = cores;
+    if (!m_pool.started()) return;
+
+    long deadline = monotonicMs() + m_timeoutMs;
+    for (;;) {
+        bool waiting = false;
+        for (size_t i=0; i < m_sources.size(); i++) {
+            if (m_sources[i].m_inFlight && !m_sources[i].m_deferred && (m_sources[i].m_submitted == ts)) {
+                waiting = true;
+                break;
+            }
+        }
 
-    m_sigar.getMemory(m_memory);
+        long left = deadline - monotonicMs();
+        if (!waiting || (left < 0)) break;
 
-    m_sigar.getSwap(m_swap);
-    m_swapCache = m_swap;
+        SourceJob* job = (SourceJob*) m_pool.finished((int) left);
+        if (job != 0) complete(job, ts);
+    }
 
-    m_sigar.getCPU(m_cpu);
+    // Late arrivals of earlier ticks
+    SourceJob* job;
+    while ((job = (SourceJob*) m_pool.finished(0)) != 0) complete(job, ts);
 
-    m_sigar.readDisksStats();
-    m_sigar.getDisk(m_disk);
-    m_diskCache = m_disk;
+    for (size_t i=0; i < m_sources.size(); i++) {
+        Source& s = m_sources[i];
+        if (!s.m_inFlight || s.m_deferred || (s.m_submitted != ts)) continue;
 
-    {
-        map< string, Disk >::iterator iter = m_disksCache.begin();
-        for ( ; iter != m_disksCache.end(); ++iter) {
-            m_sigar.getDisk(iter->first, iter->second);
+        if (initial) {
+            // Static fields keep their defaults
+            s.m_backoff = MIN_BACKOFF;
+            s.m_retryAt = ts + s.m_backoff;
+            Perf::instance().inc(m_staleCounter, 1);
+            LOG_WARN << s.m_job->name() << " did not answer at startup, retrying in " << s.m_backoff << "s";
+        }
+        else {
+            missed(i, ts, "deadline missed");
         }
     }
+}
 
-    {
-        map< string, NetMetrics >::iterator iter = m_netsCache.begin();
-        for ( ; iter != m_netsCache.end(); ++iter) {
-            m_sigar.getNet(iter->first, iter->second);
-        }
+void MetricsData::complete(SourceJob* job, int ts)
+{
+    Source& s = m_sources[job->m_source];
+    s.m_inFlight = false;
+
+    // A reading that missed its tick is too old to publish, a deferred
+    // one waits for the next tick its source is due
+    if (!s.m_deferred && (s.m_submitted != ts)) return;
+
+    if (!job->m_ok) {
+        missed(job->m_source, ts, "read failed");
+        return;
     }
 
-    {
-        map< string, FSInfo* >::iterator iter = m_fs.begin();
-        for ( ; iter != m_fs.end(); ++iter) {
-            FSInfo* fs = iter->second;
-            m_sigar.getFS(iter->first, *fs);
-        }
+    if (s.m_deferred)
+        s.m_ready = true;
+    else
+        job->publish();
+    if (s.m_backoff != 0) {
+        LOG_INFO << job->name() << " is back";
     }
+    s.m_backoff = 0;
+    s.m_retryAt = 0;
 }
 
-void MetricsData::collect()
+void MetricsData::missed(size_t source, int ts, const char* reason)
 {
-    m_sigar.readDisksStats();
+    Source& s = m_sources[source];
+    s.m_job->invalidate();
+    Perf::instance().inc(m_staleCounter, 1);
+
+    // Quarantine with exponential backoff
+    if (ts < s.m_retryAt) return;
+    s.m_backoff = (s.m_backoff == 0) ? MIN_BACKOFF : std::min(s.m_backoff * 2, MAX_BACKOFF);
+    s.m_retryAt = ts + s.m_backoff;
+    LOG_WARN << s.m_job->name() << " is stale (" << reason << "), next attempt in " << s.m_backoff << "s";
+}
 
+void MetricsData::readLoadAverages(size_t)
+{
     m_sigar.getLoadAverages(m_lavgs);
-    m_sigar.getSwap(m_swap);
+}
 
+void MetricsData::readMemory(size_t)
+{
     m_sigar.getMemory(m_memory);
+}
 
+void MetricsData::readSwap(size_t)
+{
+    m_sigar.getSwap(*m_counters.curr< Swap >(m_swap));
+}
+
+void MetricsData::readCPU(size_t)
+{
     CPU cpu;
     m_sigar.getCPU(cpu);
     m_sigar.getCPUPercent(m_cpu, cpu, m_cpuPercent);
     m_cpu = cpu;
+}
+
+void MetricsData::readCores(size_t)
+{
+    int cores;
+    m_sigar.getCpuCores(cores);
+    m_coresCount = cores;
+}
+
+void MetricsData::readPerCPU(size_t)
+{
+    m_sigar.getPerCPU(m_counters.curr< double >(m_perCpu), m_cpus);
+}
 
-    Swap swap;
-    m_sigar.getSwap(swap);
-    m_sigar.getSwapMetricsDiff(m_swapCache, swap, m_swap);
-    m_swapCache = swap;
+void MetricsData::derivePerCPU(size_t)
+{
+    columnPercents(m_counters.delta< double >(m_perCpu), PC_COUNT, m_cpus,
+                   &m_cpuTotals[0], &m_cpuPercents[0]);
+    if (m_perCpuMode != PERCPU_SUMMARY) return;
+
+    const double* user = &m_cpuPercents[PC_USER * m_cpus];
+    const double* nice = &m_cpuPercents[PC_NICE * m_cpus];
+    const double* sys = &m_cpuPercents[PC_SYSTEM * m_cpus];
+    const double* irq = &m_cpuPercents[PC_IRQ * m_cpus];
+    const double* softIrq = &m_cpuPercents[PC_SOFTIRQ * m_cpus];
+    const double* stolen = &m_cpuPercents[PC_STOLEN * m_cpus];
+
+    double busyMax = 0;
+    int over = 0;
+    for (size_t i=0; i < m_cpus; i++) {
+        double busy = user[i] + nice[i] + sys[i] + irq[i] + softIrq[i] + stolen[i];
+        m_cpuBusy[i] = busy;
+        if (busy > busyMax) busyMax = busy;
+        if (busy > m_busyThreshold) over++;
+    }
+
+    size_t p90 = (m_cpus * 9 + 9) / 10 - 1;
+    std::nth_element(m_cpuBusy.begin(), m_cpuBusy.begin() + p90, m_cpuBusy.end());
+
+    m_cpuSummary.busyMax = busyMax;
+    m_cpuSummary.busyP90 = m_cpuBusy[p90];
+    m_cpuSummary.busyOver = over;
+}
+
+void MetricsData::readSchedStat(size_t)
+{
+    m_sigar.getSchedStat(m_counters.curr< double >(m_sched), m_schedCpus);
+}
 
-    Disk disk;
-    m_sigar.getDisk(disk);
-    m_sigar.getDiskMetricsDiff(m_diskCache, disk, m_disk);
-    m_diskCache = disk;
+void MetricsData::deriveSchedStat(size_t)
+{
+    const double* delta = m_counters.delta< double >(m_sched);
+    const double* wait = delta + SS_WAIT * m_schedCpus;
+    const double* slices = delta + SS_SLICES * m_schedCpus;
+
+    double runDelay = 0;
+    double runDelayMax = 0;
+    double timeslices = 0;
+    for (size_t i=0; i < m_schedCpus; i++) {
+        runDelay += wait[i];
+        if (wait[i] > runDelayMax) runDelayMax = wait[i];
+        timeslices += slices[i];
+    }
 
+    m_schedSummary.runDelay = runDelay;
+    m_schedSummary.runDelayMax = runDelayMax;
+    m_schedSummary.timeslices = timeslices;
+    m_schedSummary.delayPerSlice = (timeslices > 0) ? runDelay / timeslices : 0;
+}
+
+void MetricsData::readProcessCount(size_t)
+{
     m_sigar.getProcessCount(m_processCount);
+}
+
+void MetricsData::readProcessStates(size_t)
+{
+    m_sigar.getProcessStates(m_processStates);
+}
+
+void MetricsData::readWatches(size_t)
+{
+    bool exited = false;
+    for (size_t i=0; i < m_watches.size(); i++) {
+        Watch& watch = m_watches[i];
+        if (watch.m_probe->pid() == 0) continue;
+        if (watch.m_probe->read(*m_counters.curr< ProcessUsage >(watch.m_slot))) continue;
+
+        LOG_INFO << "Watched process " << watch.m_name << " (PID " << watch.m_probe->pid() << ") exited";
+        watch.m_probe->detach();
+        exited = true;
+    }
+
+    // The process table follows every start and exit, sigar has to
+    // list all processes, so missing ones are only looked up now and then
+    if (m_sigar.native()) {
+        if (m_processTable.update() || exited) resolveWatches();
+    }
+    else if (exited || (monotonicMs() >= m_watchRetryAt)) {
+        resolveWatches();
+    }
+}
+
+void MetricsData::resolveWatches()
+{
+    ProcessFilters filters;
+    for (size_t i=0; i < m_watches.size(); i++) {
+        if (m_watches[i].m_probe->pid() == 0) filters.push_back(m_watches[i].m_filter);
+    }
+    if (filters.empty()) return;
+
+    ProcessIDs procs;
+    if (m_sigar.native()) {
+        m_processTable.getProcessIDs(procs);
+    }
+    else {
+        try {
+            m_sigar.getProcessIDs(filters, procs);
+        }
+        catch(int) {
+            LOG_WARN << "Failed to look up the watched processes";
+        }
+    }
+
+    // The first match of a filter is the one with the lowest PID
+    size_t missing = filters.size();
+    for (size_t i=0; i < procs.size(); i++) {
+        Watch& watch = m_watches[procs[i].id];
+        if (watch.m_probe->pid() != 0) continue;
+        if (!watch.m_probe->attach(procs[i].pid)) continue;
+
+        // Counts from the first reading, like a disk that was just attached
+        if (!watch.m_probe->read(*m_counters.curr< ProcessUsage >(watch.m_slot))) {
+            watch.m_probe->detach();
+            continue;
+        }
+        m_counters.prime(watch.m_slot, WATCH_BLOCK);
+        watch.m_fresh = true;
+        missing--;
+        LOG_INFO << "Watching " << watch.m_name << " as PID " << procs[i].pid;
+    }
+
+    if (missing != 0) m_watchRetryAt = monotonicMs() + m_watchRescan * 1000L;
+}
+
+void MetricsData::deriveWatches(size_t)
+{
+    for (size_t i=0; i < m_watches.size(); i++) {
+        Watch& watch = m_watches[i];
+        WatchMetrics& metrics = m_watchMetrics[i];
+        if (watch.m_probe->pid() == 0) {
+            blank(&metrics, sizeof(metrics));
+            continue;
+        }
+
+        const ProcessUsage* curr = m_counters.curr< ProcessUsage >(watch.m_slot);
+        const ProcessUsage* delta = m_counters.delta< ProcessUsage >(watch.m_slot);
+        metrics.pid = watch.m_probe->pid();
+        metrics.rss = curr->rss;
+        metrics.pss = curr->pss;
+        metrics.fds = curr->fds;
+
+        // No interval yet after the first reading
+        if (watch.m_fresh) {
+            watch.m_fresh = false;
+            double nan = NAN;
+            metrics.cpu = nan;
+            metrics.majorFaults = nan;
+            metrics.ctxSwitches = nan;
+            metrics.readBytes = nan;
+            metrics.writeBytes = nan;
+            continue;
+        }
+
+        // Per second like the app_ rates, over the time between the readings
+        double perSecond = (delta->clock > 0) ? 1000 / delta->clock : 0;
+        metrics.cpu = (delta->clock > 0) ? delta->cpuTime * 100 / delta->clock : 0;
+        metrics.majorFaults = delta->majorFaults * perSecond;
+        // Files that were not readable stay blank
+        metrics.ctxSwitches = (curr->ctxSwitches != curr->ctxSwitches) ? NAN : delta->ctxSwitches * perSecond;
+        metrics.readBytes = (curr->readBytes != curr->readBytes) ? NAN : delta->readBytes * perSecond;
+        metrics.writeBytes = (curr->writeBytes != curr->writeBytes) ? NAN : delta->writeBytes * perSecond;
+    }
+}
+
+void MetricsData::readTcp(size_t)
+{
     m_sigar.getTcp(m_tcp);
+}
 
-    {
-        map< string, FSInfo* >::iterator iter = m_fs.begin();
-        for ( ; iter != m_fs.end(); ++iter) {
-            FSInfo* fs = iter->second;
-            m_sigar.getFS(iter->first, *fs);
+void MetricsData::readNetStack(size_t)
+{
+    m_netSnmp.read(*m_counters.curr< NetStack >(m_netStack));
+}
+
+void MetricsData::readIrqs(size_t kind)
+{
+    double* table = m_counters.curr< double >(m_irqGroups[kind].m_slot);
+    switch (kind) {
+    case IK_SOFTNET: m_softnet.read(table, m_irqCpus); break;
+    case IK_IRQ:     m_interrupts.read(table, m_irqCpus); break;
+    case IK_SOFTIRQ: m_softirqs.read(table, m_irqCpus); break;
+    }
+}
+
+void MetricsData::deriveIrqs(size_t kind)
+{
+    IrqGroups& groups = m_irqGroups[kind];
+    const double* delta = m_counters.delta< double >(groups.m_slot);
+
+    for (size_t g=0; g < groups.m_names.size(); g++) {
+        const double* row = delta + g * m_irqCpus;
+        double total = 0;
+        double max = 0;
+        int cpus = 0;
+        for (size_t i=0; i < m_irqCpus; i++) {
+            total += row[i];
+            if (row[i] > max) max = row[i];
+            if (row[i] > 0) cpus++;
         }
+
+        IrqRollup& rollup = groups.m_rollups[g];
+        rollup.total = total;
+        rollup.max = max;
+        rollup.cpus = cpus;
     }
+}
+
+void MetricsData::readDisks(size_t)
+{
+    m_sigar.readDisksStats();
 
-    {
-        map< string, Disk* >::iterator iter = m_disks.begin();
-        for ( ; iter != m_disks.end(); ++iter) {
-            Disk disk;
-            m_sigar.getDisk(iter->first, disk);
+    // Sums over all disks
+    Disk* total = m_counters.curr< Disk >(m_disk);
+    *total = Disk();
+    m_sigar.getDisk(*total);
+
+    unsigned int generation = m_sigar.diskGeneration();
+    if (!m_diskPatterns.empty() && (generation != m_diskScan)) m_rescan = true;
+
+    vector< Device >::iterator iter = m_disks.begin();
+    for ( ; iter != m_disks.end(); ++iter) {
+        bool fresh = false;
+        if (iter->m_generation != generation) {
+            int index = m_sigar.findDisk(iter->m_name);
+            fresh = (index >= 0) && (iter->m_index < 0);
+            iter->m_index = index;
+            iter->m_generation = generation;
+        }
+        // An absent disk keeps its last reading, so its deltas are 0
+        m_sigar.getDisk(iter->m_index, *m_counters.curr< Disk >(iter->m_slot));
+        // A disk that was just attached counts from its first reading
+        if (fresh) m_counters.prime(iter->m_slot, DISK_BLOCK);
+    }
+}
 
-            map< string, Disk >::iterator jter = m_disksCache.find(iter->first);
-            if (jter == m_disksCache.end()) THROW("Mismatch disks cache");
+void MetricsData::readNet(size_t index)
+{
+    const Device& net = m_nets[index];
+    try {
+        m_sigar.getNet(net.m_name, *m_counters.curr< NetMetrics >(net.m_slot));
+    }
+    catch(int) {
+        // The interface is gone, its deltas stay 0
+    }
+}
 
-            m_sigar.getDiskMetricsDiff(jter->second, disk, *iter->second);
-            jter->second = disk;
+void MetricsData::readLinks(size_t)
+{
+    m_links.dump();
+
+    unsigned int generation = m_links.generation();
+    if (!m_netPatterns.empty() && (generation != m_linkScan)) m_rescan = true;
+
+    vector< Device >::iterator iter = m_nets.begin();
+    for ( ; iter != m_nets.end(); ++iter) {
+        bool fresh = false;
+        if (iter->m_generation != generation) {
+            int index = m_links.find(iter->m_name);
+            fresh = (index >= 0) && (iter->m_index < 0);
+            iter->m_index = index;
+            iter->m_generation = generation;
         }
+        if (iter->m_index < 0) continue;
+
+        *m_counters.curr< NetMetrics >(iter->m_slot) = m_links.stats(iter->m_index);
+        if (fresh) m_counters.prime(iter->m_slot, NET_BLOCK);
+    }
+}
+
+void MetricsData::splitList(const char* key, vector< string >& names)
+{
+    string list;
+    Config::instance().get(key, list);
+    if (list.empty()) return;
+
+    boost::split(names, list, boost::is_any_of(","));
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+}
+
+void MetricsData::fillDevices(const vector< string >& names, size_t blockSize, vector< Device >& devices)
+{
+    for (size_t i=0; i < names.size(); i++) {
+        Device device = { names[i], m_counters.add(blockSize), -1, 0 };
+        devices.push_back(device);
     }
+}
+
+void MetricsData::splitPatterns(const char* key, vector< string >& names, list< Regex* >& patterns)
+{
+    vector< string > all;
+    splitList(key, all);
 
-    {
-        map< string, NetMetrics* >::iterator iter = m_nets.begin();
-        for ( ; iter != m_nets.end(); ++iter) {
-            NetMetrics netMetrics;
-            m_sigar.getNet(iter->first, netMetrics);
+    for (size_t i=0; i < all.size(); i++) {
+        if (all[i].find_first_of("*?") == string::npos) {
+            names.push_back(all[i]);
+            continue;
+        }
+        patterns.push_back(new Regex);
+        patterns.back()->compile(all[i]);
+    }
+}
 
-            map< string, NetMetrics >::iterator jter = m_netsCache.find(iter->first);
-            if (jter == m_netsCache.end()) THROW("Mismatch net cache");
+void MetricsData::findDevices(const vector< string >& present, const list< Regex* >& patterns,
+                              const vector< Device >& known, vector< string >& found)
+{
+    for (size_t i=0; i < present.size(); i++) {
+        bool seen = false;
+        for (size_t j=0; (j < known.size()) && !seen; j++) {
+            seen = (known[j].m_name == present[i]);
+        }
+        if (seen) continue;
 
-            m_sigar.getNetMetricsDiff(jter->second, netMetrics, *iter->second);
-            jter->second = netMetrics;
+        list< Regex* >::const_iterator iter = patterns.begin();
+        for (; iter != patterns.end(); ++iter) {
+            if ((*iter)->match(present[i])) {
+                found.push_back(present[i]);
+                break;
+            }
         }
     }
 }
 
-void MetricsData::fillDisks()
+void MetricsData::listDisks(vector< string >& present)
 {
-    string disks;
-    Config::instance().get("disks", disks);
-    if (disks.empty()) return;
+    m_sigar.readDisksStats();
+    m_diskScan = m_sigar.diskGeneration();
+    for (size_t i=0; i < m_sigar.diskCount(); i++) present.push_back(m_sigar.diskName(i));
+}
 
-    vector< string > v;
-    boost::split(v, disks, boost::is_any_of(","));
-    for (size_t i=0; i < v.size(); i++) {
-        m_disks[v[i]] = new Disk;
+void MetricsData::listNets(vector< string >& present)
+{
+    m_links.dump();
+    m_linkScan = m_links.generation();
+    for (size_t i=0; i < m_links.size(); i++) present.push_back(m_links.name(i));
+}
 
-        Disk d;
-        m_disksCache[v[i]] = d;
+void MetricsData::fillDisks()
+{
+    // Names are kept as they are, patterns expand to the disks
+    // present now and pick up the ones attached later
+    vector< string > names;
+    splitPatterns("disks", names, m_diskPatterns);
+    if (!m_diskPatterns.empty()) {
+        vector< string > present;
+        listDisks(present);
+        findDevices(present, m_diskPatterns, m_disks, names);
     }
+
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    fillDevices(names, DISK_BLOCK, m_disks);
 }
 
 void MetricsData::fillNets()
 {
-    string nets;
-    Config::instance().get("nets", nets);
-    if (nets.empty()) return;
+    vector< string > names;
+    splitPatterns("nets", names, m_netPatterns);
+    if (!m_netPatterns.empty()) {
+        if (!m_sigar.native()) THROW("Interface patterns in nets need backend=native");
+
+        vector< string > present;
+        listNets(present);
+        findDevices(present, m_netPatterns, m_nets, names);
+    }
 
-    vector< string > v;
-    boost::split(v, nets, boost::is_any_of(","));
-    for (size_t i=0; i < v.size(); i++) {
-        m_nets[v[i]] = new NetMetrics;
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    fillDevices(names, NET_BLOCK, m_nets);
+}
+
+void MetricsData::startWatcher()
+{
+    if (m_diskPatterns.empty() && m_netPatterns.empty()) return;
 
-        NetMetrics nm;
-        m_netsCache[v[i]] = nm;
+    try {
+        m_watcher.start(!m_netPatterns.empty(), !m_diskPatterns.empty());
+    }
+    catch(Exception& e) {
+        LOG_WARN << e.cause() << ", new devices are found on the next change of the device tables";
     }
 }
 
+void MetricsData::discover()
+{
+    m_rescan = false;
+
+    vector< string > disks;
+    vector< string > nets;
+    try {
+        vector< string > present;
+        if (!m_diskPatterns.empty()) {
+            listDisks(present);
+            findDevices(present, m_diskPatterns, m_disks, disks);
+        }
+        present.clear();
+        if (!m_netPatterns.empty()) {
+            listNets(present);
+            findDevices(present, m_netPatterns, m_nets, nets);
+        }
+    }
+    catch(Exception& e) {
+        LOG_WARN << "Device discovery failed: " << e.cause();
+        return;
+    }
+    catch(...) {
+        LOG_WARN << "Device discovery failed";
+        return;
+    }
+    if (disks.empty() && nets.empty()) return;
+
+    for (size_t i=0; i < disks.size(); i++) LOG_INFO << "Found disk " << disks[i];
+    for (size_t i=0; i < nets.size(); i++) LOG_INFO << "Found interface " << nets[i];
+
+    // New counter blocks may move the arrays under the metrics
+    CounterStore::Layout layout = m_counters.layout();
+    size_t firstDisk = m_disks.size();
+    size_t firstNet = m_nets.size();
+    fillDevices(disks, DISK_BLOCK, m_disks);
+    fillDevices(nets, NET_BLOCK, m_nets);
+
+    MetricsList::iterator iter = m_metrics.begin();
+    for ( ; iter != m_metrics.end(); ++iter) {
+        iter->m_data = m_counters.rebase(iter->m_data, layout);
+    }
+
+    size_t first = m_metrics.size();
+    addDiskMetrics(firstDisk);
+    addNetMetrics(firstNet);
+    publishAdded(first);
+}
+
+// Metrics from first on that pass the filter become schema changes
+void MetricsData::publishAdded(size_t first)
+{
+    size_t kept = first;
+    for (size_t i=first; i < m_metrics.size(); i++) {
+        if (!selected(m_metrics[i].m_name)) continue;
+        MetricInfo mi = { m_metrics[i].m_name, METRIC_TYPES[m_metrics[i].m_type].m_name };
+        m_added.push_back(mi);
+        m_metrics[kept++] = m_metrics[i];
+    }
+    m_metrics.resize(kept);
+
+    // Existing baselines stay, the new blocks are primed on their first reading
+    sortMetrics();
+    calcSize();
+    buildPlan();
+    compileRow();
+}
+
 void MetricsData::fillFS()
 {
     string fs;
@@ -284,117 +1342,569 @@ void MetricsData::fillFS()
 
     vector< string > v;
     boost::split(v, fs, boost::is_any_of(","));
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+
+    m_fs.resize(v.size());
     for (size_t i=0; i < v.size(); i++) {
-        m_fs[v[i]] = new FSInfo;
+        m_fs[i].m_name = v[i];
+    }
+}
+
+void MetricsData::fillPerCPU()
+{
+    string mode = "off";
+    Config::instance().get("percpu", mode);
+    if (mode == "off") return;
+
+    if (mode == "columns")
+        m_perCpuMode = PERCPU_COLUMNS;
+    else if (mode == "summary")
+        m_perCpuMode = PERCPU_SUMMARY;
+    else
+        THROW("Invalid percpu: " + mode);
+
+    if (!m_sigar.native()) THROW("percpu needs backend=native");
+
+    int threshold = DEFAULT_BUSY_THRESHOLD;
+    Config::instance().get("percpu_threshold", threshold);
+    m_busyThreshold = threshold;
+
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    m_cpus = (cpus > 0) ? cpus : 1;
+    m_perCpu = m_counters.add(PC_COUNT * m_cpus);
+    m_cpuTotals.resize(m_cpus);
+    m_cpuPercents.resize(PC_COUNT * m_cpus);
+    m_cpuBusy.resize(m_cpus);
+}
+
+void MetricsData::fillSchedStat()
+{
+    int schedstat = 0;
+    Config::instance().get("schedstat", schedstat);
+    if (schedstat == 0) return;
+    if (!m_sigar.native()) THROW("schedstat needs backend=native");
+    if (!m_sigar.hasSchedStat()) {
+        LOG_INFO << "No /proc/schedstat, run queue metrics are off";
+        return;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    m_schedCpus = (cpus > 0) ? cpus : 1;
+    m_sched = m_counters.add(SS_COUNT * m_schedCpus);
+}
+
+void MetricsData::fillWatches()
+{
+    // name:exec[:args], exec is the command as in /proc/<pid>/stat and
+    // args a substring one of the arguments has to contain
+    vector< string > entries;
+    splitList("watch", entries);
+    if (entries.empty()) return;
+
+    m_watchRescan = DEFAULT_WATCH_RESCAN;
+    Config::instance().get("watch_rescan", m_watchRescan);
+    if (m_watchRescan <= 0) THROW("Invalid watch_rescan");
+
+    for (size_t i=0; i < entries.size(); i++) {
+        size_t first = entries[i].find(':');
+        if (first == string::npos) THROW("Invalid entry in watch: " + entries[i]);
+        size_t second = entries[i].find(':', first + 1);
+
+        Watch watch;
+        watch.m_name = entries[i].substr(0, first);
+        watch.m_filter.id = (int) i;
+        watch.m_filter.exec = entries[i].substr(first + 1, second - first - 1);
+        if (second != string::npos) watch.m_filter.args = entries[i].substr(second + 1);
+        watch.m_slot = m_counters.add< ProcessUsage >();
+        watch.m_probe = 0;
+        watch.m_fresh = false;
+
+        bool valid = !watch.m_name.empty() && !watch.m_filter.exec.empty();
+        for (size_t j=0; j < watch.m_name.length(); j++) {
+            char c = watch.m_name[j];
+            if (!isalnum((unsigned char) c) && (c != '_')) valid = false;
+        }
+        if (!valid) THROW("Invalid entry in watch: " + entries[i]);
+        for (size_t j=0; j < m_watches.size(); j++) {
+            if (m_watches[j].m_name == watch.m_name) THROW("Name used twice in watch: " + watch.m_name);
+        }
+
+        m_watches.push_back(watch);
+        m_watches.back().m_probe = new ProcessProbe;
+    }
+    m_watchMetrics.resize(m_watches.size());
+
+    if (!m_sigar.native()) return;
+
+    ProcessFilters filters;
+    for (size_t i=0; i < m_watches.size(); i++) filters.push_back(m_watches[i].m_filter);
+    m_processTable.setFilters(filters);
+    m_processTable.setRescan(m_watchRescan);
+    m_processTable.start();
+}
+
+void MetricsData::fillTop()
+{
+    for (int kind=0; kind < TOP_COUNT; kind++) m_topKinds[kind] = false;
+    int count = 0;
+    Config::instance().get("top_processes", count);
+    if (count < 0) THROW("Invalid top_processes");
+    if (count == 0) return;
+    if (!m_sigar.native()) THROW("top_processes needs backend=native");
+
+    vector< string > kinds;
+    splitList("top_by", kinds);
+    if (kinds.empty()) {
+        kinds.push_back(TOP_NAMES[TOP_CPU]);
+        kinds.push_back(TOP_NAMES[TOP_RSS]);
+    }
+    for (size_t i=0; i < kinds.size(); i++) {
+        const char* const* name = std::find(TOP_NAMES, TOP_NAMES + TOP_COUNT, kinds[i]);
+        if (name == TOP_NAMES + TOP_COUNT) THROW("Invalid entry in top_by: " + kinds[i]);
+        m_topKinds[name - TOP_NAMES] = true;
+    }
+
+    m_topCount = count;
+    m_top.resize(TOP_COUNT * m_topCount);
+}
+
+void MetricsData::fillApps()
+{
+    string by = "off";
+    Config::instance().get("apps", by);
+    if (by == "off") return;
+
+    if (by == "comm")
+        m_appsBy = GROUP_COMM;
+    else if (by == "cgroup")
+        m_appsBy = GROUP_CGROUP;
+    else
+        THROW("Invalid apps: " + by);
+
+    if (!m_sigar.native()) THROW("apps needs backend=native");
+
+    int io = 0;
+    Config::instance().get("apps_io", io);
+    m_appsIo = (io != 0);
+
+    // Without apps_names the largest groups of the first pass get columns
+    splitList("apps_names", m_appNames);
+    if (m_appNames.empty()) {
+        int max = DEFAULT_APPS_MAX;
+        Config::instance().get("apps_max", max);
+        if (max <= 0) THROW("Invalid apps_max");
+        m_appsPick = max;
+    }
+    for (size_t i=0; i < m_appNames.size(); i++) {
+        const string& name = m_appNames[i];
+        bool valid = !name.empty() && (name != "other");
+        for (size_t j=0; j < name.length(); j++) {
+            if (!isalnum((unsigned char) name[j]) && (name[j] != '_')) valid = false;
+        }
+        if (!valid) THROW("Invalid entry in apps_names: " + name);
+    }
+}
+
+void MetricsData::startScanner()
+{
+    if ((m_topCount == 0) && (m_appsBy == GROUP_NONE)) return;
+
+    m_topRate = DEFAULT_TOP_RATE;
+    Config::instance().get("top_rate", m_topRate);
+    if (m_topRate <= 0) THROW("Invalid top_rate");
+    int threads = DEFAULT_TOP_THREADS;
+    Config::instance().get("top_threads", threads);
+    if (threads <= 0) THROW("Invalid top_threads");
+    m_topTimeoutMs = DEFAULT_TOP_TIMEOUT_MS;
+    Config::instance().get("top_timeout", m_topTimeoutMs);
+    if (m_topTimeoutMs <= 0) THROW("Invalid top_timeout");
+
+    bool io = (m_topCount != 0) && m_topKinds[TOP_IO];
+    m_scanner = new ProcessScanner();
+    m_scanner->setGroupBy(m_appsBy);
+    m_scanner->start(m_topCount, threads, io || m_appsIo);
+    if (m_appsBy == GROUP_NONE) return;
+
+    // Metrics point into m_apps, groups picked later must not move it
+    m_apps.reserve(1 + m_appNames.size() + m_appsPick);
+    m_apps.resize(1);
+    for (size_t i=0; i < m_appNames.size(); i++) {
+        if (!m_appSlots.insert(std::make_pair(m_appNames[i], m_apps.size())).second) {
+            THROW("Name used twice in apps_names: " + m_appNames[i]);
+        }
+        m_apps.push_back(GroupUsage());
     }
+}
+
+void MetricsData::addApps()
+{
+    LOG_INFO << "Apps by " << ((m_appsBy == GROUP_COMM) ? "comm" : "cgroup") << ": "
+             << boost::join(m_appsPicked, ",");
+
+    size_t first = m_apps.size();
+    for (size_t i=0; i < m_appsPicked.size(); i++) {
+        m_appSlots[m_appsPicked[i]] = m_apps.size();
+        m_appNames.push_back(m_appsPicked[i]);
+        m_apps.push_back(GroupUsage());
+        blank(&m_apps.back(), sizeof(GroupUsage));
+    }
+    m_appsPicked.clear();
+
+    size_t added = m_metrics.size();
+    addAppMetrics(first);
+    publishAdded(added);
+}
 
+void MetricsData::addAppMetrics(size_t first)
+{
+    size_t fields = FIELDS_COUNT(APP_FIELDS) - (m_appsIo ? 0 : 1);
+    for (size_t i=first; i < m_apps.size(); i++) {
+        string prefix = "app_" + ((i == 0) ? string("other") : m_appNames[i - 1]) + "_";
+        for (size_t j=0; j < fields; j++) {
+            double* data = (double*) ((char*) &m_apps[i] + APP_FIELDS[j].m_offset);
+            addMetric(m_scanSource, prefix + APP_FIELDS[j].m_name, data, APP_FIELDS[j].m_type, m_topRate);
+        }
+    }
 }
 
-static Metric makeMetric(int rate, double* data, string type)
+void MetricsData::fillNetStack()
 {
-    bool integer = (type != "double") && (type != "float");
-    Metric metric = { rate, data, type, integer };
-    return metric;
+    int netstack = 0;
+    Config::instance().get("netstack", netstack);
+    if (netstack == 0) return;
+    if (!m_sigar.native()) THROW("netstack needs backend=native");
+
+    m_netStack = m_counters.add< NetStack >();
+    m_netStackOn = true;
+}
+
+void MetricsData::fillTcpDiag()
+{
+    string mode = "off";
+    Config::instance().get("tcp_diag", mode);
+
+    vector< string > ports;
+    splitList("tcp_ports", ports);
+
+    if (mode == "off") {
+        if (!ports.empty()) THROW("tcp_ports needs tcp_diag");
+        return;
+    }
+    if (mode == "states")
+        m_tcpDiagMode = TCPDIAG_STATES;
+    else if (mode == "info")
+        m_tcpDiagMode = TCPDIAG_INFO;
+    else
+        THROW("Invalid tcp_diag: " + mode);
+
+    for (size_t i=0; i < ports.size(); i++) {
+        int port = atoi(ports[i].c_str());
+        if ((port <= 0) || (port > 65535)) THROW("Invalid port in tcp_ports: " + ports[i]);
+        m_tcpPortNumbers.push_back(port);
+    }
+    std::sort(m_tcpPortNumbers.begin(), m_tcpPortNumbers.end());
+    m_tcpPortNumbers.erase(std::unique(m_tcpPortNumbers.begin(), m_tcpPortNumbers.end()), m_tcpPortNumbers.end());
+    m_tcpPorts.resize(m_tcpPortNumbers.size());
+}
+
+void MetricsData::fillIrqs()
+{
+    int softnet = 0;
+    Config::instance().get("softnet", softnet);
+    if (softnet != 0) {
+        m_irqGroups[IK_SOFTNET].m_names.assign(SOFTNET_GROUPS, SOFTNET_GROUPS + SN_COUNT);
+    }
+    fillIrqGroups("irqs", m_interrupts, m_irqGroups[IK_IRQ]);
+    fillIrqGroups("softirqs", m_softirqs, m_irqGroups[IK_SOFTIRQ]);
+
+    string rollup = "total";
+    Config::instance().get("irq_rollup", rollup);
+    if (rollup == "columns")
+        m_irqColumns = true;
+    else if (rollup != "total")
+        THROW("Invalid irq_rollup: " + rollup);
+
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    m_irqCpus = (cpus > 0) ? cpus : 1;
+
+    for (size_t kind=0; kind < IK_COUNT; kind++) {
+        IrqGroups& groups = m_irqGroups[kind];
+        if (groups.m_names.empty()) continue;
+        groups.m_slot = m_counters.add(groups.m_names.size() * m_irqCpus);
+        groups.m_rollups.resize(groups.m_names.size());
+    }
+}
+
+void MetricsData::fillIrqGroups(const char* key, IrqTable& table, IrqGroups& groups)
+{
+    vector< string > patterns;
+    splitList(key, patterns);
+
+    for (size_t i=0; i < patterns.size(); i++) {
+        // The pattern without wildcards names the group
+        string name;
+        for (size_t j=0; j < patterns[i].length(); j++) {
+            char c = patterns[i][j];
+            if ((c == '*') || (c == '?')) continue;
+            name += isalnum((unsigned char) c) ? c : '_';
+        }
+        if (name.empty()) THROW(string("Invalid pattern in ") + key + ": " + patterns[i]);
+        if (std::find(groups.m_names.begin(), groups.m_names.end(), name) != groups.m_names.end()) {
+            THROW(string("Patterns in ") + key + " give the same name: " + name);
+        }
+
+        table.addGroup(patterns[i]);
+        groups.m_names.push_back(name);
+    }
+}
+
+const char* MetricsData::intern(const string& name)
+{
+    return m_names.insert(name).first->c_str();
+}
+
+size_t MetricsData::addSource(Source::Reader reader, size_t arg)
+{
+    Source source = { reader, arg, false, false, 0, false, 0, false, 0, 0, 0, false, false };
+    m_sources.push_back(source);
+    return m_sources.size() - 1;
+}
+
+size_t MetricsData::addSource(SourceJob* job)
+{
+    size_t source = addSource(0, 0);
+    job->m_source = source;
+    m_sources[source].m_job = job;
+    return source;
+}
+
+void MetricsData::addMetric(size_t source, const string& name, double* data, MetricType type, int rate)
+{
+    Metric metric = { intern(name), rate, data, type, source };
+    m_metrics.push_back(metric);
+}
+
+void MetricsData::addFields(size_t source, const string& prefix, void* base, const MetricField* fields, size_t count)
+{
+    for (size_t i=0; i < count; i++) {
+        double* data = (double*) ((char*) base + fields[i].m_offset);
+        addMetric(source, prefix + fields[i].m_name, data, fields[i].m_type, fields[i].m_rate);
+    }
+}
+
+void MetricsData::sortMetrics()
+{
+    std::stable_sort(m_metrics.begin(), m_metrics.end(), metricLess);
+    m_metrics.erase(std::unique(m_metrics.begin(), m_metrics.end(), metricSame), m_metrics.end());
 }
 
 void MetricsData::fillMetrics()
 {
-    m_metrics["lavg_1min"] = makeMetric(1, &m_lavgs._1min, "short");
-    m_metrics["lavg_5min"] = makeMetric(60, &m_lavgs._5min, "short");
-    m_metrics["lavg_15min"] = makeMetric(300, &m_lavgs._15min, "short");
-
-    m_metrics["memory_total"] = makeMetric(0, &m_memory.total, "int");
-    m_metrics["memory_used"] = makeMetric(1, &m_memory.used, "int");
-    m_metrics["memory_free"] = makeMetric(1, &m_memory.free, "int");
-
-    m_metrics["swap_total"] = makeMetric(0, &m_swap.total, "int");
-    m_metrics["swap_used"] = makeMetric(1, &m_swap.used, "int");
-    m_metrics["swap_free"] = makeMetric(1, &m_swap.free, "int");
-    m_metrics["swap_pageIn"] = makeMetric(1, &m_swap.page_in, "int");
-    m_metrics["swap_pageOut"] = makeMetric(1, &m_swap.page_out, "int");
-
-    m_metrics["disk_reads"] = makeMetric(1, &m_disk.reads, "short");
-    m_metrics["disk_writes"] = makeMetric(1, &m_disk.writes, "short");
-    m_metrics["disk_readBytes"] = makeMetric(1, &m_disk.readBytes, "int");
-    m_metrics["disk_writeBytes"] = makeMetric(1, &m_disk.writeBytes, "int");
-    m_metrics["disk_readTime"] = makeMetric(1, &m_disk.readTime, "short");
-    m_metrics["disk_writeTime"] = makeMetric(1, &m_disk.writeTime, "short");
-    m_metrics["disk_totalTime"] = makeMetric(1, &m_disk.totalTime, "short");
-    m_metrics["disk_waitTime"] = makeMetric(1, &m_disk.waitTime, "short");
-    m_metrics["disk_queue"] = makeMetric(1, &m_disk.queue, "short");
-
-    m_metrics["cpu_total"] = makeMetric(1, &m_cpuPercent.combined, "float");
-    m_metrics["cpu_user"] = makeMetric(1, &m_cpuPercent.user, "float");
-    m_metrics["cpu_system"] = makeMetric(1, &m_cpuPercent.sys, "float");
-    m_metrics["cpu_nice"] = makeMetric(1, &m_cpuPercent.nice, "float");
-    m_metrics["cpu_idle"] = makeMetric(1, &m_cpuPercent.idle, "float");
-    m_metrics["cpu_wait"] = makeMetric(1, &m_cpuPercent.wait, "float");
-    m_metrics["cpu_irq"] = makeMetric(1, &m_cpuPercent.irq, "float");
-    m_metrics["cpu_softIrq"] = makeMetric(1, &m_cpuPercent.softIrq, "float");
-    m_metrics["cpu_stolen"] = makeMetric(1, &m_cpuPercent.stolen, "float");
-
-    m_metrics["process_count"] = makeMetric(1, &m_processCount.total, "short");
-    m_metrics["thread_count"] = makeMetric(1, &m_processCount.threads, "short");
-    m_metrics["cores_count"] = makeMetric(0, &m_coresCount, "byte");
-
-    m_metrics["tcp_open"] = makeMetric(1, &m_tcp.connOpens, "int");
-    m_metrics["tcp_fail"] = makeMetric(1, &m_tcp.connFailed, "int");
-    m_metrics["tcp_count"] = makeMetric(1, &m_tcp.connections, "int");
-    m_metrics["tcp_recv"] = makeMetric(1, &m_tcp.inSeg, "int");
-    m_metrics["tcp_sent"] = makeMetric(1, &m_tcp.outSeg, "int");
-    m_metrics["tcp_retr"] = makeMetric(1, &m_tcp.retransmits, "int");
-
-    string prefix = "disk_";
-    map< string, Disk* >::iterator iter = m_disks.begin();
-    for ( ; iter != m_disks.end(); ++iter) {
-        Disk* disk = iter->second;
-        m_metrics[prefix+iter->first+"_reads"] = makeMetric(1, &disk->reads, "short");
-        m_metrics[prefix+iter->first+"_writes"] = makeMetric(1, &disk->writes, "short");
-        m_metrics[prefix+iter->first+"_readBytes"] = makeMetric(1, &disk->readBytes, "int");
-        m_metrics[prefix+iter->first+"_writeBytes"] = makeMetric(1, &disk->writeBytes, "int");
-        m_metrics[prefix+iter->first+"_readTime"] = makeMetric(1, &disk->readTime, "short");
-        m_metrics[prefix+iter->first+"_writeTime"] = makeMetric(1, &disk->writeTime, "short");
-        m_metrics[prefix+iter->first+"_queueTime"] = makeMetric(1, &disk->queueTime, "short");
-        m_metrics[prefix+iter->first+"_totalTime"] = makeMetric(1, &disk->totalTime, "short");
-        m_metrics[prefix+iter->first+"_queue"] = makeMetric(1, &disk->queue, "short");
-    }
-
-    prefix = "net_";
-    map< string, NetMetrics* >::iterator jter = m_nets.begin();
-    for ( ; jter != m_nets.end(); ++jter) {
-        NetMetrics* net = jter->second;
-        m_metrics[prefix+jter->first+"_rxPackets"] = makeMetric(1, &net->rxPackets, "int");
-        m_metrics[prefix+jter->first+"_rxBytes"] = makeMetric(1, &net->rxBytes, "int");
-        m_metrics[prefix+jter->first+"_rxErrors"] = makeMetric(1, &net->rxErrors, "int");
-        m_metrics[prefix+jter->first+"_rxDropped"] = makeMetric(1, &net->rxDropped, "int");
-        m_metrics[prefix+jter->first+"_rxOverruns"] = makeMetric(1, &net->rxOverruns, "int");
-
-        m_metrics[prefix+jter->first+"_txPackets"] = makeMetric(1, &net->txPackets, "int");
-        m_metrics[prefix+jter->first+"_txBytes"] = makeMetric(1, &net->txBytes, "int");
-        m_metrics[prefix+jter->first+"_txErrors"] = makeMetric(1, &net->txErrors, "int");
-        m_metrics[prefix+jter->first+"_txDropped"] = makeMetric(1, &net->txDropped, "int");
-        m_metrics[prefix+jter->first+"_txOverruns"] = makeMetric(1, &net->txOverruns, "int");
-    }
-
-    prefix = "fs_";
-    map< string, FSInfo* >::iterator kter = m_fs.begin();
-    for ( ; kter != m_fs.end(); ++kter) {
-        FSInfo* fs = kter->second;
-
-        string name = kter->first;
+    size_t source = addSource(&MetricsData::readLoadAverages, 0);
+    addFields(source, "lavg_", &m_lavgs, LAVG_FIELDS, FIELDS_COUNT(LAVG_FIELDS));
+
+    source = addSource(&MetricsData::readMemory, 0);
+    addFields(source, "memory_", &m_memory, MEMORY_FIELDS, FIELDS_COUNT(MEMORY_FIELDS));
+    if (m_sigar.native()) {
+        addFields(source, "memory_", &m_memory, MEMORY_NATIVE_FIELDS, FIELDS_COUNT(MEMORY_NATIVE_FIELDS));
+    }
+
+    source = addSource(&MetricsData::readSwap, 0);
+    addFields(source, "swap_", m_counters.curr< Swap >(m_swap), SWAP_GAUGE_FIELDS, FIELDS_COUNT(SWAP_GAUGE_FIELDS));
+    addFields(source, "swap_", m_counters.delta< Swap >(m_swap), SWAP_COUNTER_FIELDS, FIELDS_COUNT(SWAP_COUNTER_FIELDS));
+
+    source = addSource(&MetricsData::readCPU, 0);
+    addFields(source, "cpu_", &m_cpuPercent, CPU_FIELDS, FIELDS_COUNT(CPU_FIELDS));
+    if (m_sigar.native()) {
+        addFields(source, "cpu_", &m_cpuPercent, CPU_NATIVE_FIELDS, FIELDS_COUNT(CPU_NATIVE_FIELDS));
+    }
+
+    if (m_perCpuMode != PERCPU_OFF) {
+        source = addSource(&MetricsData::readPerCPU, 0);
+        m_sources[source].m_derive = &MetricsData::derivePerCPU;
+
+        if (m_perCpuMode == PERCPU_SUMMARY) {
+            addFields(source, "cpu_", &m_cpuSummary, CPU_SUMMARY_FIELDS, FIELDS_COUNT(CPU_SUMMARY_FIELDS));
+        }
+        else {
+            for (size_t i=0; i < m_cpus; i++) {
+                char prefix[32];
+                snprintf(prefix, sizeof(prefix), "cpu%u_", (unsigned int) i);
+                for (size_t j=0; j < FIELDS_COUNT(PER_CPU_COLUMNS); j++) {
+                    double* data = &m_cpuPercents[PER_CPU_COLUMNS[j].m_field * m_cpus + i];
+                    addMetric(source, string(prefix) + PER_CPU_COLUMNS[j].m_name, data, MT_FLOAT, 1);
+                }
+            }
+        }
+    }
+
+    // Run queue waits next to the CPU times, per CPU along with the
+    // other per-CPU columns
+    if (m_schedCpus != 0) {
+        source = addSource(&MetricsData::readSchedStat, 0);
+        m_sources[source].m_derive = &MetricsData::deriveSchedStat;
+        addFields(source, "cpu_", &m_schedSummary, SCHED_FIELDS, FIELDS_COUNT(SCHED_FIELDS));
+
+        if (m_perCpuMode == PERCPU_COLUMNS) {
+            double* wait = m_counters.delta< double >(m_sched) + SS_WAIT * m_schedCpus;
+            for (size_t i=0; i < m_schedCpus; i++) {
+                char name[32];
+                snprintf(name, sizeof(name), "cpu%u_runDelay", (unsigned int) i);
+                addMetric(source, name, wait + i, MT_INT, 1);
+            }
+        }
+    }
+
+    source = addSource(&MetricsData::readCores, 0);
+    addMetric(source, "cores_count", &m_coresCount, MT_BYTE, 0);
+
+    source = addSource(&MetricsData::readProcessCount, 0);
+    addFields(source, "", &m_processCount, PROCESS_FIELDS, FIELDS_COUNT(PROCESS_FIELDS));
+    if (m_sigar.native()) {
+        addFields(source, "", &m_processCount, PROCESS_NATIVE_FIELDS, FIELDS_COUNT(PROCESS_NATIVE_FIELDS));
+    }
+
+    // Reads every /proc/<pid>/stat, so only at the rate asked for
+    Config::instance().get("process_states", m_processStatesRate);
+    if (m_processStatesRate < 0) THROW("Invalid process_states");
+    if (m_processStatesRate > 0) {
+        if (!m_sigar.native()) THROW("process_states needs backend=native");
+
+        source = addSource(&MetricsData::readProcessStates, 0);
+        for (size_t i=0; i < FIELDS_COUNT(PROCESS_STATE_FIELDS); i++) {
+            const MetricField& field = PROCESS_STATE_FIELDS[i];
+            double* data = (double*) ((char*) &m_processStates + field.m_offset);
+            addMetric(source, string("procstate_") + field.m_name, data, field.m_type, m_processStatesRate);
+        }
+    }
+
+    if (!m_watches.empty()) {
+        source = addSource(&MetricsData::readWatches, 0);
+        m_sources[source].m_derive = &MetricsData::deriveWatches;
+        for (size_t i=0; i < m_watches.size(); i++) {
+            addFields(source, "proc_" + m_watches[i].m_name + "_", &m_watchMetrics[i],
+                      WATCH_FIELDS, FIELDS_COUNT(WATCH_FIELDS));
+        }
+    }
+
+    // top_<kind>_<rank>_ and app_<name>_ from one pass over /proc per top_rate
+    if ((m_scanner != 0) && m_scanner->started()) {
+        source = addSource(new ProcessScanJob(*m_scanner, m_topTimeoutMs, m_topKinds, m_topCount,
+                                              m_top, m_appSlots, m_apps, m_appsPick, m_appsPicked));
+        m_scanSource = source;
+        m_sources[source].m_deferred = true;
+        size_t fields = FIELDS_COUNT(TOP_FIELDS) - (m_topKinds[TOP_IO] ? 0 : 1);
+        for (int kind=0; kind < TOP_COUNT; kind++) {
+            if (!m_topKinds[kind]) continue;
+            for (size_t i=0; i < m_topCount; i++) {
+                char prefix[32];
+                snprintf(prefix, sizeof(prefix), "top_%s_%u_", TOP_NAMES[kind], (unsigned int) i + 1);
+                TopEntry* entry = &m_top[kind * m_topCount + i];
+                for (size_t j=0; j < fields; j++) {
+                    double* data = (double*) ((char*) entry + TOP_FIELDS[j].m_offset);
+                    addMetric(source, string(prefix) + TOP_FIELDS[j].m_name, data,
+                              TOP_FIELDS[j].m_type, m_topRate);
+                }
+            }
+        }
+        addAppMetrics(0);
+    }
+
+    source = addSource(&MetricsData::readTcp, 0);
+    addFields(source, "tcp_", &m_tcp, TCP_FIELDS, FIELDS_COUNT(TCP_FIELDS));
+
+    // Per-CPU counts rolled up per group, the counts themselves as
+    // columns if asked for
+    for (size_t kind=0; kind < IK_COUNT; kind++) {
+        IrqGroups& groups = m_irqGroups[kind];
+        if (groups.m_names.empty()) continue;
+
+        source = addSource(&MetricsData::readIrqs, kind);
+        m_sources[source].m_derive = &MetricsData::deriveIrqs;
+        for (size_t g=0; g < groups.m_names.size(); g++) {
+            string prefix = IRQ_PREFIXES[kind] + groups.m_names[g] + "_";
+            addFields(source, prefix, &groups.m_rollups[g], IRQ_ROLLUP_FIELDS, FIELDS_COUNT(IRQ_ROLLUP_FIELDS));
+            if (!m_irqColumns) continue;
+
+            double* delta = m_counters.delta< double >(groups.m_slot) + g * m_irqCpus;
+            for (size_t i=0; i < m_irqCpus; i++) {
+                char name[32];
+                snprintf(name, sizeof(name), "cpu%u", (unsigned int) i);
+                addMetric(source, prefix + name, delta + i, MT_INT, 1);
+            }
+        }
+    }
+
+    // One pass over /proc/net/netstat and /proc/net/snmp
+    if (m_netStackOn) {
+        source = addSource(&MetricsData::readNetStack, 0);
+        NetStack* delta = m_counters.delta< NetStack >(m_netStack);
+        addFields(source, "tcpext_", delta, TCPEXT_FIELDS, FIELDS_COUNT(TCPEXT_FIELDS));
+        addFields(source, "ipext_", delta, IPEXT_FIELDS, FIELDS_COUNT(IPEXT_FIELDS));
+        addFields(source, "tcp_", delta, TCP_SNMP_FIELDS, FIELDS_COUNT(TCP_SNMP_FIELDS));
+        addFields(source, "udp_", delta, UDP_FIELDS, FIELDS_COUNT(UDP_FIELDS));
+    }
+
+    if (m_tcpDiagMode != TCPDIAG_OFF) {
+        SockDiag* diag = new SockDiag();
+        diag->setInfo(m_tcpDiagMode == TCPDIAG_INFO);
+        diag->setPorts(m_tcpPortNumbers);
+        source = addSource(new TcpDiagJob(diag, m_tcpStates, m_tcpHistogram, m_tcpPorts));
+        addFields(source, "tcp_", &m_tcpStates, TCP_STATE_FIELDS, FIELDS_COUNT(TCP_STATE_FIELDS));
+        if (m_tcpDiagMode == TCPDIAG_INFO) {
+            addFields(source, "tcp_", &m_tcpHistogram, TCP_HISTOGRAM_FIELDS, FIELDS_COUNT(TCP_HISTOGRAM_FIELDS));
+        }
+        for (size_t i=0; i < m_tcpPorts.size(); i++) {
+            char prefix[32];
+            snprintf(prefix, sizeof(prefix), "tcp_port%d_", m_tcpPortNumbers[i]);
+            addFields(source, prefix, &m_tcpPorts[i], TCP_PORT_FIELDS, FIELDS_COUNT(TCP_PORT_FIELDS));
+        }
+    }
+
+    // One pass over /proc/diskstats serves the totals and every disk
+    m_disksSource = addSource(&MetricsData::readDisks, 0);
+    addFields(m_disksSource, "disk_", m_counters.curr< Disk >(m_disk), DISK_GAUGE_FIELDS, FIELDS_COUNT(DISK_GAUGE_FIELDS));
+    addFields(m_disksSource, "disk_", m_counters.delta< Disk >(m_disk), DISK_TOTAL_FIELDS, FIELDS_COUNT(DISK_TOTAL_FIELDS));
+    addDiskMetrics(0);
+
+    // One netlink dump serves every interface, sigar reads them one by one
+    if (m_sigar.native() && (!m_nets.empty() || !m_netPatterns.empty())) {
+        m_linksSource = addSource(&MetricsData::readLinks, 0);
+    }
+    addNetMetrics(0);
+
+    for (size_t i=0; i < m_fs.size(); i++) {
+        string name = m_fs[i].m_name;
         if (name == "/") 
             name = "";
         else {
-            for (size_t i=0; i < name.length(); i++) {
-                if (name[i] == '/') name[i] = '_';
+            for (size_t j=0; j < name.length(); j++) {
+                if (name[j] == '/') name[j] = '_';
             }
         }
 
-        m_metrics[prefix+name+"_total"] = makeMetric(0, &fs->totalSpace, "int");
-        m_metrics[prefix+name+"_usedPercent"] = makeMetric(10, &fs->usedPercent, "byte");
-        m_metrics[prefix+name+"_free"] = makeMetric(10, &fs->freeSpace, "int");
-        m_metrics[prefix+name+"_used"] = makeMetric(10, &fs->usedSpace, "int");
-        m_metrics[prefix+name+"_avail"] = makeMetric(10, &fs->availSpace, "int");
+        source = addSource(new FSJob(m_fs[i]));
+        addFields(source, "fs_" + name + "_", &m_fs[i].m_info, FS_FIELDS, FIELDS_COUNT(FS_FIELDS));
+    }
+}
+
+void MetricsData::addDiskMetrics(size_t first)
+{
+    for (size_t i=first; i < m_disks.size(); i++) {
+        string prefix = "disk_" + m_disks[i].m_name + "_";
+        size_t slot = m_disks[i].m_slot;
+        addFields(m_disksSource, prefix, m_counters.curr< Disk >(slot), DISK_GAUGE_FIELDS, FIELDS_COUNT(DISK_GAUGE_FIELDS));
+        addFields(m_disksSource, prefix, m_counters.delta< Disk >(slot), DISK_FIELDS, FIELDS_COUNT(DISK_FIELDS));
+    }
+}
+
+void MetricsData::addNetMetrics(size_t first)
+{
+    for (size_t i=first; i < m_nets.size(); i++) {
+        size_t source = m_linksSource;
+        if (!m_sigar.native()) source = addSource(&MetricsData::readNet, i);
+        addFields(source, "net_" + m_nets[i].m_name + "_", m_counters.delta< NetMetrics >(m_nets[i].m_slot), NET_FIELDS, FIELDS_COUNT(NET_FIELDS));
     }
 }
 
@@ -404,45 +1914,101 @@ void MetricsData::filterMetrics()
     Config::instance().get("filter", filter);
     if (filter.empty()) return;
 
-    list< Regex* > regex;
+    // Kept for the metrics of devices found later
     vector< string > v;
     boost::split(v, filter, boost::is_any_of(","));
     for (size_t i=0; i < v.size(); i++) {
-        regex.push_back(new Regex);
-        regex.back()->compile(v[i]);
+        m_filters.push_back(new Regex);
+        m_filters.back()->compile(v[i]);
     }
 
-    MetricsMap filtered;
-    MetricsMap::iterator iter = m_metrics.begin();
+    MetricsList filtered;
+    MetricsList::iterator iter = m_metrics.begin();
     for (; iter != m_metrics.end(); ++iter) {
-        list<Regex*>::iterator jter = regex.begin();
-        for (; jter != regex.end(); ++jter) {
-            Regex* r = *jter;
-            if (r->match(iter->first)) {
-                filtered[iter->first] = iter->second;
-                break;
-            }
-        }
+        if (selected(iter->m_name)) filtered.push_back(*iter);
     }
     m_metrics.swap(filtered);
+}
+
+bool MetricsData::selected(const char* name)
+{
+    if (m_filters.empty()) return true;
 
-    list<Regex*>::iterator jter = regex.begin();
-    for (; jter != regex.end(); ++jter) delete *jter;
+    list< Regex* >::iterator iter = m_filters.begin();
+    for (; iter != m_filters.end(); ++iter) {
+        if ((*iter)->match(name)) return true;
+    }
+    return false;
+}
+
+void MetricsData::startPool()
+{
+    bool async = false;
+    for (size_t i=0; i < m_sources.size(); i++) {
+        if (m_sources[i].m_used && (m_sources[i].m_job != 0)) async = true;
+    }
+    if (!async) return;
+
+    int workers = DEFAULT_WORKERS;
+    Config::instance().get("workers", workers);
+    if (workers <= 0) THROW("Invalid workers");
+
+    m_timeoutMs = DEFAULT_COLLECT_TIMEOUT_MS;
+    Config::instance().get("collect_timeout", m_timeoutMs);
+    if (m_timeoutMs < 0) THROW("Invalid collect_timeout");
+
+    m_staleCounter = Perf::instance().counter("lincore.stale_sources");
+    m_pool.start(workers);
+}
+
+void MetricsData::compileRow()
+{
+    m_row.clear();
+
+    MetricsList::iterator iter = m_metrics.begin();
+    for (; iter != m_metrics.end(); ++iter) {
+        if (iter->m_rate == 0) continue;
+        m_row.addColumn(iter->m_data, iter->m_rate, METRIC_TYPES[iter->m_type].m_precision);
+    }
+
+    m_row.compile();
+}
+
+void MetricsData::buildPlan()
+{
+    map< int, set< size_t > > rates;
+
+    MetricsList::iterator iter = m_metrics.begin();
+    for (; iter != m_metrics.end(); ++iter) {
+        m_sources[iter->m_source].m_used = true;
+        if (iter->m_rate != 0) rates[iter->m_rate].insert(iter->m_source);
+    }
+
+    m_plan.clear();
+    map< int, set< size_t > >::iterator jter = rates.begin();
+    for (; jter != rates.end(); ++jter) {
+        RateGroup group;
+        group.m_rate = jter->first;
+        group.m_sources.assign(jter->second.begin(), jter->second.end());
+        m_plan.push_back(group);
+    }
+
+    size_t used = 0;
+    for (size_t i=0; i < m_sources.size(); i++) {
+        if (m_sources[i].m_used) used++;
+    }
+    LOG_INFO << "Collection plan: " << used << " of " << m_sources.size()
+             << " sources in " << m_plan.size() << " rate groups";
 }
 
 void MetricsData::calcSize()
 {
     size_t sz = 0;
-    MetricsMap::iterator iter = m_metrics.begin();
+    MetricsList::iterator iter = m_metrics.begin();
     for (; iter != m_metrics.end(); ++iter) {
-        if (iter->second.m_type == "byte") sz += 1;
-        else if (iter->second.m_type == "short") sz += 2;
-        else if (iter->second.m_type == "int") sz += 4;
-        else if (iter->second.m_type == "float") sz += 4;
-        else if (iter->second.m_type == "double") sz += 8;
+        sz += METRIC_TYPES[iter->m_type].m_size;
     }
     LOG_INFO << "Row data size: " << sz;
 }
 
 } // namespace lincore
-
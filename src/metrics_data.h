@@ -20,22 +20,68 @@
 #define METRICS_DATA_H
 
 #include "sigar_iface.h"
+#include "row_formatter.h"
+#include "counter_store.h"
+#include "worker_pool.h"
+#include "net_links.h"
+#include "device_watcher.h"
+#include "sock_diag.h"
+#include "net_snmp.h"
+#include "irq_stats.h"
+#include "process_probe.h"
+#include "process_table.h"
+#include "process_scanner.h"
+#include "utils/regex_processor.h"
+#include <stddef.h>
 #include <string>
 #include <map>
+#include <set>
 #include <list>
+#include <vector>
 
 using std::string;
 using std::map;
+using std::set;
 using std::list;
+using std::vector;
 
 namespace lincore {
 
+enum MetricType
+{
+    MT_BYTE,
+    MT_SHORT,
+    MT_INT,
+    MT_FLOAT,
+    MT_DOUBLE,
+    MT_COUNT
+};
+
+// Storage size in a ClockWorkDB row and digits after the point
+template< MetricType T > struct MetricTraits;
+template<> struct MetricTraits< MT_BYTE >   { enum { SIZE = 1, PRECISION = 0 }; };
+template<> struct MetricTraits< MT_SHORT >  { enum { SIZE = 2, PRECISION = 0 }; };
+template<> struct MetricTraits< MT_INT >    { enum { SIZE = 4, PRECISION = 0 }; };
+template<> struct MetricTraits< MT_FLOAT >  { enum { SIZE = 4, PRECISION = 2 }; };
+template<> struct MetricTraits< MT_DOUBLE > { enum { SIZE = 8, PRECISION = 2 }; };
+
+struct MetricTypeInfo
+{
+    const char* m_name;
+    int m_size;
+    int m_precision;
+};
+
+// Indexed by MetricType
+extern const MetricTypeInfo METRIC_TYPES[MT_COUNT];
+
 struct Metric
 {
+    const char* m_name;     // interned, lives as long as MetricsData
     int m_rate;
     double* m_data;
-    string m_type;
-    bool m_integer;
+    MetricType m_type;
+    size_t m_source;        // index of the source that reads m_data
 };
 
 struct MetricInfo
@@ -44,52 +90,360 @@ struct MetricInfo
     string m_type;
 };
 
-typedef map< string, Metric > MetricsMap;
+// One double member of a collected struct
+struct MetricField
+{
+    const char* m_name;
+    size_t m_offset;
+    MetricType m_type;
+    int m_rate;
+};
+
+#define METRIC_FIELD(Struct,member,name,type,rate) \
+    { name, offsetof(Struct, member), type, rate }
+
+// Sorted by name once the set of metrics is known
+typedef vector< Metric > MetricsList;
+
+// A disk or interface and its block in the counter store
+struct Device
+{
+    string m_name;
+    size_t m_slot;
+    int m_index;                // position in the source table, -1 if absent
+    unsigned int m_generation;  // of the table m_index was resolved in
+};
+
+struct Mount
+{
+    string m_name;
+    FSInfo m_info;
+};
+
+enum PerCPUMode
+{
+    PERCPU_OFF,
+    PERCPU_COLUMNS,     // cpuN_ metrics for every CPU
+    PERCPU_SUMMARY      // cpu_busy* over all CPUs
+};
+
+// Run queue waits over all CPUs, from /proc/schedstat
+struct SchedSummary
+{
+    SchedSummary() : runDelay(0), runDelayMax(0), timeslices(0), delayPerSlice(0) {}
+    double runDelay;        // ms tasks waited for a CPU
+    double runDelayMax;     // of the CPU with the longest waits
+    double timeslices;
+    double delayPerSlice;   // ms a timeslice waited on average
+};
+
+// Per-CPU counters rolled up per group
+enum IrqKind
+{
+    IK_SOFTNET,     // groups are the SoftnetField rows
+    IK_IRQ,
+    IK_SOFTIRQ,
+    IK_COUNT
+};
+
+struct IrqRollup
+{
+    IrqRollup() : total(0), max(0), cpus(0) {}
+    double total;
+    double max;     // of the busiest CPU
+    double cpus;    // CPUs with any
+};
+
+struct IrqGroups
+{
+    IrqGroups() : m_slot(0) {}
+    size_t m_slot;
+    vector< string > m_names;
+    vector< IrqRollup > m_rollups;
+};
+
+// A process of the watch list, proc_<name>_ metrics
+struct Watch
+{
+    string m_name;
+    ProcessFilter m_filter;     // id is the position in the list
+    size_t m_slot;              // ProcessUsage block
+    ProcessProbe* m_probe;      // detached while no process matches
+    bool m_fresh;               // attached since the last reading
+};
+
+struct WatchMetrics
+{
+    WatchMetrics() : pid(0), cpu(0), rss(0), pss(0), majorFaults(0), ctxSwitches(0),
+                     fds(0), readBytes(0), writeBytes(0) {}
+    double pid;
+    double cpu;             // percent of one CPU
+    double rss;
+    double pss;
+    double majorFaults;
+    double ctxSwitches;
+    double fds;
+    double readBytes;
+    double writeBytes;
+};
+
+enum TcpDiagMode
+{
+    TCPDIAG_OFF,
+    TCPDIAG_STATES,     // sockets by state, accept queues of tcp_ports
+    TCPDIAG_INFO        // and the RTT and retransmit histogram
+};
+
+struct CPUSummary
+{
+    CPUSummary() : busyMax(0), busyP90(0), busyOver(0) {}
+    double busyMax;
+    double busyP90;
+    double busyOver;    // CPUs busier than percpu_threshold
+};
+
+/************************************
+ * Reads a source that may block on the worker pool. The result is
+ * kept aside until the collector thread publishes it; a reading
+ * that missed its deadline is invalidated instead.
+ ************************************/
+class SourceJob : public Job
+{
+public:
+    SourceJob() : m_source(0), m_ok(false) {}
+    virtual string name() = 0;
+    virtual void publish() = 0;
+    // Blank the source fields
+    virtual void invalidate() = 0;
+
+    size_t m_source;
+    bool m_ok;
+};
+
+typedef boost::unordered_map< string, size_t > AppSlots;
 
 class MetricsData
 {
 public:
+    MetricsData() : m_timeoutMs(0), m_staleCounter(0), m_swap(0), m_disk(0), m_netStack(0), m_netStackOn(false),
+                    m_perCpuMode(PERCPU_OFF), m_cpus(0), m_perCpu(0), m_busyThreshold(0),
+                    m_sched(0), m_schedCpus(0), m_processStatesRate(0),
+                    m_watchRescan(0), m_watchRetryAt(0), m_scanner(0), m_topCount(0), m_topRate(0),
+                    m_topTimeoutMs(0), m_appsBy(GROUP_NONE), m_appsIo(false), m_appsPick(0), m_scanSource(0),
+                    m_tcpDiagMode(TCPDIAG_OFF), m_irqCpus(0), m_irqColumns(false),
+                    m_interrupts("/proc/interrupts"), m_softirqs("/proc/softirqs"),
+                    m_disksSource(0), m_linksSource(0), m_rescan(false),
+                    m_diskScan(0), m_linkScan(0) {}
     ~MetricsData();
 
     void init();
     void uninit();
 
     void getMetricsInfo(list< MetricInfo >& info);
+    // Metrics of devices found since the last call. The stream
+    // title changes along with them.
+    bool getSchemaChanges(list< MetricInfo >& added);
 
     string getStreamTitle();
     string getStaticMetrics();
-    string getStreamMetrics(int ts);
+    // Metrics whose rate boundary lies in (prevTs, ts] are due.
+    // The row stays valid until the next call.
+    const char* getStreamMetrics(int ts, int prevTs, size_t& length);
 
+    // Reads every source some metric depends on
     void collectInitial();
-    void collect();
+    // Reads only the sources with a metric due at ts
+    void collect(int ts, int prevTs);
+
+private:
+    // Reads one data source, the argument tells devices apart
+    struct Source
+    {
+        typedef void (MetricsData::*Reader)(size_t arg);
+        Reader m_reader;
+        size_t m_arg;
+        bool m_used;
+        bool m_due;
+
+        // Called after the counter deltas of a tick the source was read in
+        Reader m_derive;
+        bool m_read;
+
+        // Sources read on the worker pool
+        SourceJob* m_job;
+        bool m_inFlight;
+        int m_submitted;    // tick the job was submitted at
+        int m_retryAt;      // quarantined until this tick
+        int m_backoff;
+
+        // Published on the next due tick rather than the one it was
+        // submitted on, for readings longer than a tick
+        bool m_deferred;
+        bool m_ready;
+    };
+
+    // Sources with a metric of the rate
+    struct RateGroup
+    {
+        int m_rate;
+        vector< size_t > m_sources;
+    };
 
 private:
     SigarIface m_sigar;
 
-    MetricsMap m_metrics;
-    
+    MetricsList m_metrics;
+    set< string > m_names;
+    RowFormatter m_row;
+    CounterStore m_counters;
+    vector< Source > m_sources;
+    vector< RateGroup > m_plan;
+    WorkerPool m_pool;
+    int m_timeoutMs;
+    long* m_staleCounter;
+
     LoadAverages m_lavgs;
     Memory m_memory;
-    Swap m_swap, m_swapCache;
-    Disk m_disk, m_diskCache;
+    size_t m_swap;
+    size_t m_disk;
+    size_t m_netStack;
+    bool m_netStackOn;
+    NetSnmp m_netSnmp;
     CPU m_cpu;
     CPUPercent m_cpuPercent;
+    PerCPUMode m_perCpuMode;
+    size_t m_cpus;
+    size_t m_perCpu;
+    double m_busyThreshold;
+    vector< double > m_cpuTotals;
+    vector< double > m_cpuPercents;     // PerCPUField rows of m_cpus
+    vector< double > m_cpuBusy;
+    CPUSummary m_cpuSummary;
+    size_t m_sched;
+    size_t m_schedCpus;
+    SchedSummary m_schedSummary;
     ProcessCount m_processCount;
+    ProcessStates m_processStates;
+    int m_processStatesRate;
+    vector< Watch > m_watches;
+    vector< WatchMetrics > m_watchMetrics;
+    ProcessTable m_processTable;
+    int m_watchRescan;
+    long m_watchRetryAt;    // monotonic ms of the next lookup of the missing ones
+    ProcessScanner* m_scanner;  // left behind with a scan still out
+    size_t m_topCount;
+    int m_topRate;
+    int m_topTimeoutMs;
+    bool m_topKinds[TOP_COUNT];
+    vector< TopEntry > m_top;   // m_topCount entries per kind
+    GroupBy m_appsBy;
+    bool m_appsIo;
+    vector< string > m_appNames;
+    AppSlots m_appSlots;        // index in m_apps of each name
+    vector< GroupUsage > m_apps;    // other, then m_appNames
+    size_t m_appsPick;          // apps_max until the first pass picked them
+    vector< string > m_appsPicked;
+    size_t m_scanSource;
     double m_coresCount;
-    map< string, FSInfo* > m_fs;
-    map< string, Disk* > m_disks;
-    map< string, Disk > m_disksCache;
-    map< string, NetMetrics* > m_nets;
-    map< string, NetMetrics > m_netsCache;
+    vector< Mount > m_fs;
+    vector< Device > m_disks;
+    vector< Device > m_nets;
+    NetLinks m_links;
     Tcp m_tcp;
+    TcpDiagMode m_tcpDiagMode;
+    TcpStates m_tcpStates;
+    TcpHistogram m_tcpHistogram;
+    vector< int > m_tcpPortNumbers;
+    vector< TcpPort > m_tcpPorts;
+    size_t m_irqCpus;
+    bool m_irqColumns;
+    IrqGroups m_irqGroups[IK_COUNT];
+    SoftnetStat m_softnet;
+    IrqTable m_interrupts;
+    IrqTable m_softirqs;
+
+    // Hot-plug discovery of the devices matching a pattern
+    list< cdb::Regex* > m_diskPatterns;
+    list< cdb::Regex* > m_netPatterns;
+    list< cdb::Regex* > m_filters;
+    size_t m_disksSource;
+    size_t m_linksSource;
+    DeviceWatcher m_watcher;
+    bool m_rescan;
+    unsigned int m_diskScan;    // device table generations the patterns
+    unsigned int m_linkScan;    // were last matched against
+    list< MetricInfo > m_added;
 
 private:
+    const char* intern(const string& name);
+    size_t addSource(Source::Reader reader, size_t arg);
+    size_t addSource(SourceJob* job);
+    void addMetric(size_t source, const string& name, double* data, MetricType type, int rate);
+    void addFields(size_t source, const string& prefix, void* base, const MetricField* fields, size_t count);
+    void sortMetrics();
+
+    void read(size_t source);
+    void derive();
+    void submit(size_t source, int ts);
+    void waitJobs(int ts, bool initial);
+    void complete(SourceJob* job, int ts);
+    void missed(size_t source, int ts, const char* reason);
+    void readLoadAverages(size_t);
+    void readMemory(size_t);
+    void readSwap(size_t);
+    void readCPU(size_t);
+    void readCores(size_t);
+    void readPerCPU(size_t);
+    void derivePerCPU(size_t);
+    void readSchedStat(size_t);
+    void deriveSchedStat(size_t);
+    void readProcessCount(size_t);
+    void readProcessStates(size_t);
+    void readWatches(size_t);
+    void deriveWatches(size_t);
+    void resolveWatches();
+    void readTcp(size_t);
+    void readNetStack(size_t);
+    void readIrqs(size_t kind);
+    void deriveIrqs(size_t kind);
+    void readDisks(size_t);
+    void readNet(size_t index);
+    void readLinks(size_t);
+
     void fillMetrics();
+    void addDiskMetrics(size_t first);
+    void addNetMetrics(size_t first);
+    void publishAdded(size_t first);
+    void splitList(const char* key, vector< string >& names);
+    void splitPatterns(const char* key, vector< string >& names, list< cdb::Regex* >& patterns);
+    void findDevices(const vector< string >& present, const list< cdb::Regex* >& patterns,
+                     const vector< Device >& known, vector< string >& found);
+    void listDisks(vector< string >& present);
+    void listNets(vector< string >& present);
+    void fillDevices(const vector< string >& names, size_t blockSize, vector< Device >& devices);
     void fillDisks();
     void fillNets();
+    void startWatcher();
+    void discover();
+    bool selected(const char* name);
     void fillFS();
+    void fillPerCPU();
+    void fillSchedStat();
+    void fillWatches();
+    void fillTop();
+    void fillApps();
+    void startScanner();
+    void addApps();
+    void addAppMetrics(size_t first);
+    void fillNetStack();
+    void fillTcpDiag();
+    void fillIrqs();
+    void fillIrqGroups(const char* key, IrqTable& table, IrqGroups& groups);
     void filterMetrics();
     void calcSize();
+    void buildPlan();
+    void startPool();
+    void compileRow();
 };
 
 } //namespace lincore
@@ -0,0 +1,219 @@
+/**********************************************
+   File:   net_links.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "net_links.h"
+#include "utils/exception.h"
+#include "utils/misc.h"
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace cdb;
+
+namespace lincore {
+
+static const size_t RECEIVE_BUFFER_SIZE = 65536;
+static const int RECEIVE_TIMEOUT_SEC = 1;
+
+NetLinks::~NetLinks()
+{
+    close();
+}
+
+void NetLinks::open()
+{
+    m_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (m_fd < 0) THROW("Failed to open netlink socket: " + getSystemError());
+
+    struct timeval tv = { RECEIVE_TIMEOUT_SEC, 0 };
+    setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_nl local;
+    memset(&local, 0, sizeof(local));
+    local.nl_family = AF_NETLINK;
+    if (bind(m_fd, (struct sockaddr*) &local, sizeof(local)) != 0) {
+        string error = getSystemError();
+        close();
+        THROW("Failed to bind netlink socket: " + error);
+    }
+
+    m_buffer.resize(RECEIVE_BUFFER_SIZE);
+}
+
+void NetLinks::close()
+{
+    if (m_fd < 0) return;
+    ::close(m_fd);
+    m_fd = -1;
+}
+
+void NetLinks::dump()
+{
+    if (m_fd < 0) open();
+
+    try {
+        request();
+
+        size_t count = 0;
+        bool changed = false;
+        while (receive(count, changed));
+
+        if (count != m_links.size()) {
+            m_links.resize(count);
+            changed = true;
+        }
+        if (changed) m_generation++;
+    }
+    catch(Exception&) {
+        close();
+        throw;
+    }
+}
+
+int NetLinks::find(const string& name)
+{
+    for (size_t i=0; i < m_links.size(); i++) {
+        if (m_links[i].m_name == name) return (int) i;
+    }
+    return -1;
+}
+
+bool NetLinks::contains(int ifindex)
+{
+    for (size_t i=0; i < m_links.size(); i++) {
+        if (m_links[i].m_ifindex == ifindex) return true;
+    }
+    return false;
+}
+
+void NetLinks::request()
+{
+    struct {
+        struct nlmsghdr m_header;
+        struct ifinfomsg m_info;
+    } req;
+
+    memset(&req, 0, sizeof(req));
+    req.m_header.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.m_header.nlmsg_type = RTM_GETLINK;
+    req.m_header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.m_header.nlmsg_seq = ++m_seq;
+    req.m_info.ifi_family = AF_UNSPEC;
+
+    struct sockaddr_nl kernel;
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+
+    ssize_t n;
+    do {
+        n = sendto(m_fd, &req, req.m_header.nlmsg_len, 0, (struct sockaddr*) &kernel, sizeof(kernel));
+    } while ((n < 0) && (errno == EINTR));
+    if (n < 0) THROW("Failed to request links: " + getSystemError());
+}
+
+bool NetLinks::receive(size_t& count, bool& changed)
+{
+    ssize_t n;
+    do {
+        n = recv(m_fd, &m_buffer[0], m_buffer.size(), 0);
+    } while ((n < 0) && (errno == EINTR));
+    if (n < 0) THROW("Failed to receive links: " + getSystemError());
+
+    int length = (int) n;
+    struct nlmsghdr* header = (struct nlmsghdr*) &m_buffer[0];
+    for ( ; NLMSG_OK(header, length); header = NLMSG_NEXT(header, length)) {
+        if (header->nlmsg_seq != m_seq) continue;
+
+        if (header->nlmsg_type == NLMSG_DONE) return false;
+        if (header->nlmsg_type == NLMSG_ERROR) {
+            struct nlmsgerr* err = (struct nlmsgerr*) NLMSG_DATA(header);
+            errno = -err->error;
+            THROW("Link dump failed: " + getSystemError());
+        }
+        if (header->nlmsg_type != RTM_NEWLINK) continue;
+
+        parseLink(header, count, changed);
+        count++;
+    }
+    return true;
+}
+
+void NetLinks::parseLink(const void* message, size_t count, bool& changed)
+{
+    struct nlmsghdr* header = (struct nlmsghdr*) message;
+    struct ifinfomsg* info = (struct ifinfomsg*) NLMSG_DATA(header);
+
+    if (count == m_links.size()) m_links.push_back(Link());
+    Link& link = m_links[count];
+    if (link.m_ifindex != info->ifi_index) {
+        link.m_ifindex = info->ifi_index;
+        changed = true;
+    }
+
+    bool stats64 = false;
+    int length = IFLA_PAYLOAD(header);
+    struct rtattr* attr = IFLA_RTA(info);
+    for ( ; RTA_OK(attr, length); attr = RTA_NEXT(attr, length)) {
+        if (attr->rta_type == IFLA_IFNAME) {
+            const char* name = (const char*) RTA_DATA(attr);
+            if (link.m_name != name) {
+                link.m_name = name;
+                changed = true;
+            }
+        }
+        else if ((attr->rta_type == IFLA_STATS64) && (RTA_PAYLOAD(attr) >= sizeof(struct rtnl_link_stats64))) {
+            struct rtnl_link_stats64 s;
+            memcpy(&s, RTA_DATA(attr), sizeof(s));
+
+            link.m_stats.rxPackets = s.rx_packets;
+            link.m_stats.rxBytes = s.rx_bytes;
+            link.m_stats.rxErrors = s.rx_errors;
+            link.m_stats.rxDropped = s.rx_dropped;
+            link.m_stats.rxOverruns = s.rx_fifo_errors;
+            link.m_stats.txPackets = s.tx_packets;
+            link.m_stats.txBytes = s.tx_bytes;
+            link.m_stats.txErrors = s.tx_errors;
+            link.m_stats.txDropped = s.tx_dropped;
+            link.m_stats.txOverruns = s.tx_fifo_errors;
+            stats64 = true;
+        }
+        else if ((attr->rta_type == IFLA_STATS) && !stats64 &&
+                 (RTA_PAYLOAD(attr) >= sizeof(struct rtnl_link_stats))) {
+            struct rtnl_link_stats s;
+            memcpy(&s, RTA_DATA(attr), sizeof(s));
+
+            link.m_stats.rxPackets = s.rx_packets;
+            link.m_stats.rxBytes = s.rx_bytes;
+            link.m_stats.rxErrors = s.rx_errors;
+            link.m_stats.rxDropped = s.rx_dropped;
+            link.m_stats.rxOverruns = s.rx_fifo_errors;
+            link.m_stats.txPackets = s.tx_packets;
+            link.m_stats.txBytes = s.tx_bytes;
+            link.m_stats.txErrors = s.tx_errors;
+            link.m_stats.txDropped = s.tx_dropped;
+            link.m_stats.txOverruns = s.tx_fifo_errors;
+        }
+    }
+}
+
+} // namespace lincore
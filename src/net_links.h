@@ -0,0 +1,86 @@
+/**********************************************
+   File:   net_links.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef NET_LINKS_H
+#define NET_LINKS_H
+
+#include "sigar_iface.h"
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace lincore {
+
+/************************************
+ * Counters of every network interface from one RTM_GETLINK dump
+ * over a netlink socket that stays open. The 64 bit IFLA_STATS64
+ * block is used, IFLA_STATS on kernels without it.
+ ************************************/
+class NetLinks
+{
+public:
+    NetLinks() : m_fd(-1), m_seq(0), m_generation(0) {}
+    ~NetLinks();
+
+    // Throws if the dump fails, the socket is reopened on the next call
+    void dump();
+
+    size_t size() { return m_links.size(); }
+    const string& name(size_t index) { return m_links[index].m_name; }
+    const NetMetrics& stats(size_t index) { return m_links[index].m_stats; }
+
+    // Position of the interface in the last dump, -1 if absent.
+    // Positions stay valid while generation() does not change.
+    int find(const string& name);
+    // True if the interface index was in the last dump
+    bool contains(int ifindex);
+    unsigned int generation() { return m_generation; }
+
+private:
+    struct Link
+    {
+        Link() : m_ifindex(0) {}
+        int m_ifindex;
+        string m_name;
+        NetMetrics m_stats;
+    };
+
+private:
+    int m_fd;
+    unsigned int m_seq;
+    unsigned int m_generation;
+    vector< Link > m_links;
+    vector< char > m_buffer;
+
+private:
+    NetLinks(const NetLinks&);
+    NetLinks& operator=(const NetLinks&);
+
+    void open();
+    void close();
+    void request();
+    // False once the dump is complete
+    bool receive(size_t& count, bool& changed);
+    void parseLink(const void* message, size_t count, bool& changed);
+};
+
+} // namespace lincore
+
+#endif // NET_LINKS_H
@@ -0,0 +1,140 @@
+/**********************************************
+   File:   net_snmp.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "net_snmp.h"
+#include "proc_parse.h"
+#include "utils/exception.h"
+#include "utils/misc.h"
+#include <stddef.h>
+#include <string.h>
+
+using namespace cdb;
+
+namespace lincore {
+
+struct Column
+{
+    const char* m_section;
+    const char* m_name;
+    size_t m_offset;
+};
+
+#define COLUMN(section,name,member) { section, name, offsetof(NetStack, member) }
+
+static const Column COLUMNS[] = {
+    COLUMN("TcpExt", "ListenOverflows",  listenOverflows),
+    COLUMN("TcpExt", "ListenDrops",      listenDrops),
+    COLUMN("TcpExt", "TCPBacklogDrop",   backlogDrop),
+    COLUMN("TcpExt", "PruneCalled",      pruneCalled),
+    COLUMN("TcpExt", "RcvPruned",        rcvPruned),
+    COLUMN("TcpExt", "TCPTimeouts",      timeouts),
+    COLUMN("TcpExt", "TCPSynRetrans",    synRetrans),
+    COLUMN("TcpExt", "SyncookiesSent",   syncookiesSent),
+    COLUMN("TcpExt", "TCPAbortOnMemory", abortOnMemory),
+    COLUMN("TcpExt", "TCPReqQFullDrop",  reqQFullDrop),
+    COLUMN("IpExt",  "InNoRoutes",       inNoRoutes),
+    COLUMN("IpExt",  "InTruncatedPkts",  inTruncatedPkts),
+    COLUMN("IpExt",  "InCsumErrors",     ipInCsumErrors),
+    COLUMN("Tcp",    "InErrs",           tcpInErrs),
+    COLUMN("Tcp",    "OutRsts",          tcpOutRsts),
+    COLUMN("Udp",    "InDatagrams",      udpInDatagrams),
+    COLUMN("Udp",    "OutDatagrams",     udpOutDatagrams),
+    COLUMN("Udp",    "NoPorts",          udpNoPorts),
+    COLUMN("Udp",    "InErrors",         udpInErrors),
+    COLUMN("Udp",    "RcvbufErrors",     udpRcvbufErrors),
+    COLUMN("Udp",    "SndbufErrors",     udpSndbufErrors)
+};
+
+static const size_t COLUMNS_COUNT = sizeof(COLUMNS) / sizeof(COLUMNS[0]);
+
+void NetSnmp::read(NetStack& stack)
+{
+    if (!m_netstat.read()) THROW("Failed to read " + m_netstat.path() + ": " + getSystemError());
+    if (!m_snmp.read()) THROW("Failed to read " + m_snmp.path() + ": " + getSystemError());
+
+    double* values = reinterpret_cast< double* >(&stack);
+    parse(m_netstat, m_netstatSections, values);
+    parse(m_snmp, m_snmpSections, values);
+}
+
+void NetSnmp::parse(ProcReader& file, vector< Section >& sections, double* values)
+{
+    size_t index = 0;
+    char* p = file.data();
+    while (*p) {
+        char* header = p;
+        char* line = nextLine(header);
+        if (*line == '\0') break;
+        p = nextLine(line);
+
+        size_t length = line - header;
+        if (index == sections.size()) sections.push_back(Section());
+        Section& section = sections[index++];
+        if ((section.m_header.length() != length) ||
+            (memcmp(section.m_header.data(), header, length) != 0)) {
+            mapColumns(header, length, section);
+        }
+
+        char* v = strchr(line, ':');
+        if ((v == NULL) || (v >= p)) continue;
+        v++;
+
+        for (size_t column=0; column < section.m_fields.size(); column++) {
+            v = skipBlanks(v);
+            if (*v == '-') v++;
+            if (!isDigit(*v)) break;
+
+            unsigned long value;
+            v = parseNumber(v, value);
+            int field = section.m_fields[column];
+            if (field >= 0) values[field] = value;
+        }
+    }
+}
+
+void NetSnmp::mapColumns(const char* header, size_t length, Section& section)
+{
+    section.m_header.assign(header, length);
+    section.m_fields.clear();
+
+    string line(header, length);
+    size_t colon = line.find(':');
+    if (colon == string::npos) return;
+    string name = line.substr(0, colon);
+
+    size_t pos = colon + 1;
+    for (;;) {
+        pos = line.find_first_not_of(" \t\n", pos);
+        if (pos == string::npos) break;
+        size_t end = line.find_first_of(" \t\n", pos);
+        if (end == string::npos) end = line.length();
+        string column = line.substr(pos, end - pos);
+        pos = end;
+
+        int field = -1;
+        for (size_t i=0; i < COLUMNS_COUNT; i++) {
+            if ((name == COLUMNS[i].m_section) && (column == COLUMNS[i].m_name)) {
+                field = (int) (COLUMNS[i].m_offset / sizeof(double));
+                break;
+            }
+        }
+        section.m_fields.push_back(field);
+    }
+}
+
+} // namespace lincore
@@ -0,0 +1,101 @@
+/**********************************************
+   File:   net_snmp.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef NET_SNMP_H
+#define NET_SNMP_H
+
+#include "proc_reader.h"
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace lincore {
+
+// Network stack counters the SNMP getters of sigar leave out
+struct NetStack
+{
+    NetStack() : listenOverflows(0), listenDrops(0), backlogDrop(0), pruneCalled(0),
+                 rcvPruned(0), timeouts(0), synRetrans(0), syncookiesSent(0),
+                 abortOnMemory(0), reqQFullDrop(0), inNoRoutes(0), inTruncatedPkts(0),
+                 ipInCsumErrors(0), tcpInErrs(0), tcpOutRsts(0), udpInDatagrams(0),
+                 udpOutDatagrams(0), udpNoPorts(0), udpInErrors(0), udpRcvbufErrors(0),
+                 udpSndbufErrors(0) {}
+    // TcpExt
+    double listenOverflows;
+    double listenDrops;
+    double backlogDrop;
+    double pruneCalled;
+    double rcvPruned;
+    double timeouts;
+    double synRetrans;
+    double syncookiesSent;
+    double abortOnMemory;
+    double reqQFullDrop;
+    // IpExt
+    double inNoRoutes;
+    double inTruncatedPkts;
+    double ipInCsumErrors;
+    // Tcp
+    double tcpInErrs;
+    double tcpOutRsts;
+    // Udp
+    double udpInDatagrams;
+    double udpOutDatagrams;
+    double udpNoPorts;
+    double udpInErrors;
+    double udpRcvbufErrors;
+    double udpSndbufErrors;
+};
+
+/************************************
+ * Reads /proc/net/netstat and /proc/net/snmp. Both come as pairs of
+ * lines, "Section: names" followed by "Section: values". The column
+ * of every wanted counter is looked up once per header; as long as
+ * a header reads the same the values line is only parsed as numbers.
+ ************************************/
+class NetSnmp
+{
+public:
+    NetSnmp() : m_netstat("/proc/net/netstat"), m_snmp("/proc/net/snmp") {}
+
+    // Throws if a file cannot be read
+    void read(NetStack& stack);
+
+private:
+    struct Section
+    {
+        string m_header;        // the columns were mapped from
+        vector< int > m_fields; // NetStack double of each column, -1 if not wanted
+    };
+
+private:
+    ProcReader m_netstat;
+    ProcReader m_snmp;
+    vector< Section > m_netstatSections;
+    vector< Section > m_snmpSections;
+
+private:
+    void parse(ProcReader& file, vector< Section >& sections, double* values);
+    void mapColumns(const char* header, size_t length, Section& section);
+};
+
+} // namespace lincore
+
+#endif // NET_SNMP_H
@@ -0,0 +1,364 @@
+/**********************************************
+   File:   proc_backend.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "proc_backend.h"
+#include "proc_parse.h"
+#include "sigar_iface.h"
+#include "utils/exception.h"
+#include "utils/misc.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace cdb;
+
+namespace lincore {
+
+struct KeyField
+{
+    const char* m_key;
+    size_t m_length;
+    int m_field;
+};
+
+#define KEY_FIELD(key,field) { key, sizeof(key) - 1, field }
+
+// Looks up "key" followed by the separator, returns the field or -1
+static int findKey(const char* line, char separator, const KeyField* keys, size_t count)
+{
+    for (size_t i=0; i < count; i++) {
+        if ((line[keys[i].m_length] == separator) &&
+            (memcmp(line, keys[i].m_key, keys[i].m_length) == 0)) return keys[i].m_field;
+    }
+    return -1;
+}
+
+// "key<separator> value ..." lines into values[field]
+static void parseKeyValues(char* text, char separator, const KeyField* keys, size_t count, unsigned long* values)
+{
+    for (char* p = text; *p; p = nextLine(p)) {
+        int field = findKey(p, separator, keys, count);
+        if (field < 0) continue;
+
+        char* v = skipBlanks(strchr(p, separator) + 1);
+        parseNumber(v, values[field]);
+    }
+}
+
+ProcBackend::ProcBackend() :
+    m_stat("/proc/stat"),
+    m_meminfo("/proc/meminfo"),
+    m_vmstat("/proc/vmstat"),
+    m_loadavg("/proc/loadavg"),
+    m_schedstat("/proc/schedstat"),
+    m_statFresh(false),
+    m_meminfoFresh(false),
+    m_vmstatFresh(false),
+    m_loadavgFresh(false),
+    m_procDir(-1)
+{
+    memset(m_memInfo, 0, sizeof(m_memInfo));
+    memset(m_vmStat, 0, sizeof(m_vmStat));
+
+    m_msecPerTick = msecPerTick();
+}
+
+ProcBackend::~ProcBackend()
+{
+    if (m_procDir >= 0) close(m_procDir);
+}
+
+void ProcBackend::invalidate()
+{
+    m_statFresh = false;
+    m_meminfoFresh = false;
+    m_vmstatFresh = false;
+    m_loadavgFresh = false;
+}
+
+void ProcBackend::read(ProcReader& reader)
+{
+    if (!reader.read()) THROW("Failed to read " + reader.path() + ": " + getSystemError());
+}
+
+void ProcBackend::getLoadAverages(LoadAverages& systemLoad)
+{
+    readLoadavg();
+
+    char* end;
+    systemLoad._1min = strtod(m_loadavg.data(), &end);
+    systemLoad._5min = strtod(end, &end);
+    systemLoad._15min = strtod(end, &end);
+}
+
+void ProcBackend::getMemory(Memory& memory)
+{
+    readMeminfo();
+
+    double total = m_memInfo[MI_TOTAL];
+    double free = m_memInfo[MI_FREE];
+    double cache = m_memInfo[MI_BUFFERS] + m_memInfo[MI_CACHED];
+
+    // Same definitions as sigar_mem_get()
+    memory.total = total;
+    memory.free = free;
+    memory.used = total - free;
+    memory.actualFree = free + cache;
+    memory.actualUsed = memory.used - cache;
+    memory.percentUsed = (total > 0) ? memory.actualUsed * 100 / total : 0;
+    memory.percentFree = (total > 0) ? memory.actualFree * 100 / total : 0;
+
+    memory.available = m_memInfo[MI_AVAILABLE];
+    memory.dirty = m_memInfo[MI_DIRTY];
+    memory.writeback = m_memInfo[MI_WRITEBACK];
+}
+
+void ProcBackend::getSwap(Swap& swap)
+{
+    readMeminfo();
+    readVmstat();
+
+    swap.total = m_memInfo[MI_SWAP_TOTAL];
+    swap.free = m_memInfo[MI_SWAP_FREE];
+    swap.used = swap.total - swap.free;
+    swap.page_in = m_vmStat[VM_PSWPIN];
+    swap.page_out = m_vmStat[VM_PSWPOUT];
+}
+
+void ProcBackend::getCPU(CPU& cpu)
+{
+    readStat();
+
+    char* p = m_stat.data();
+    if ((strncmp(p, "cpu", 3) != 0) || (p[3] != ' ')) THROW("Unexpected format of /proc/stat");
+    p += 3;
+
+    // user nice system idle iowait irq softirq steal guest guest_nice,
+    // older kernels stop earlier
+    static const int CPU_FIELDS = 10;
+    unsigned long v[CPU_FIELDS] = { 0 };
+    for (int i=0; i < CPU_FIELDS; i++) {
+        p = skipBlanks(p);
+        if (!isDigit(*p)) break;
+        p = parseNumber(p, v[i]);
+    }
+
+    cpu.user = v[0] * m_msecPerTick;
+    cpu.nice = v[1] * m_msecPerTick;
+    cpu.sys = v[2] * m_msecPerTick;
+    cpu.idle = v[3] * m_msecPerTick;
+    cpu.wait = v[4] * m_msecPerTick;
+    cpu.irq = v[5] * m_msecPerTick;
+    cpu.softIrq = v[6] * m_msecPerTick;
+    cpu.stolen = v[7] * m_msecPerTick;
+    cpu.guest = v[8] * m_msecPerTick;
+    cpu.guestNice = v[9] * m_msecPerTick;
+
+    // Guest time is already part of user and nice
+    cpu.total = cpu.user + cpu.nice + cpu.sys + cpu.idle + cpu.wait +
+                cpu.irq + cpu.softIrq + cpu.stolen;
+}
+
+void ProcBackend::getPerCPU(double* table, size_t cpus)
+{
+    readStat();
+
+    // cpuN lines follow the aggregate one
+    for (char* p = nextLine(m_stat.data()); strncmp(p, "cpu", 3) == 0; p = nextLine(p)) {
+        unsigned long cpu;
+        char* v = parseNumber(p + 3, cpu);
+        if ((v == p + 3) || (cpu >= cpus)) continue;
+
+        for (int f=0; f < PC_COUNT; f++) {
+            v = skipBlanks(v);
+            if (!isDigit(*v)) break;
+
+            unsigned long ticks;
+            v = parseNumber(v, ticks);
+            table[f * cpus + cpu] = ticks * m_msecPerTick;
+        }
+    }
+}
+
+bool ProcBackend::hasSchedStat()
+{
+    return access(m_schedstat.path().c_str(), R_OK) == 0;
+}
+
+void ProcBackend::getSchedStat(double* table, size_t cpus)
+{
+    // Columns after "cpuN" up to the sched_info ones
+    static const int SCHED_INFO_COLUMN = 6;
+    static const double NSEC_PER_MSEC = 1e6;
+
+    read(m_schedstat);
+
+    // "cpuN" lines, each followed by its "domainN" lines
+    for (char* p = m_schedstat.data(); *p; p = nextLine(p)) {
+        if (strncmp(p, "cpu", 3) != 0) continue;
+
+        unsigned long cpu;
+        char* v = parseNumber(p + 3, cpu);
+        if ((v == p + 3) || (cpu >= cpus)) continue;
+
+        unsigned long values[SCHED_INFO_COLUMN + SS_COUNT];
+        int count = 0;
+        for ( ; count < SCHED_INFO_COLUMN + SS_COUNT; count++) {
+            v = skipBlanks(v);
+            if (!isDigit(*v)) break;
+            v = parseNumber(v, values[count]);
+        }
+        if (count < SCHED_INFO_COLUMN + SS_COUNT) continue;
+
+        table[SS_RUN * cpus + cpu] = values[SCHED_INFO_COLUMN + SS_RUN] / NSEC_PER_MSEC;
+        table[SS_WAIT * cpus + cpu] = values[SCHED_INFO_COLUMN + SS_WAIT] / NSEC_PER_MSEC;
+        table[SS_SLICES * cpus + cpu] = values[SCHED_INFO_COLUMN + SS_SLICES];
+    }
+}
+
+void ProcBackend::openProcDir()
+{
+    static const size_t DIRENTS_BUFFER_SIZE = 32768;
+
+    m_procDir = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (m_procDir < 0) THROW("Failed to open /proc: " + getSystemError());
+    m_dirents.resize(DIRENTS_BUFFER_SIZE);
+}
+
+// Counts the state letter after the command in /proc/<pid>/stat
+struct StateCounter
+{
+    explicit StateCounter(ProcessStates& states) : m_states(states) {}
+
+    void operator()(const char* pid) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%s/stat", pid);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+
+        // The command is at most 16 bytes but may contain ") "
+        char buf[512];
+        ssize_t n = ::read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (n <= 0) return;
+        buf[n] = '\0';
+
+        const char* end = strrchr(buf, ')');
+        if ((end == NULL) || (end[1] != ' ')) return;
+
+        switch (end[2]) {
+        case 'R': m_states.running++; break;
+        case 'S': m_states.sleeping++; break;
+        case 'D': m_states.diskSleep++; break;
+        case 'Z': m_states.zombie++; break;
+        case 'T':
+        case 't': m_states.stopped++; break;
+        case 'I': m_states.idle++; break;
+        }
+    }
+
+    ProcessStates& m_states;
+};
+
+void ProcBackend::getProcessCount(ProcessCount& processCount)
+{
+    // "0.00 0.01 0.05 running/threads lastpid"
+    readLoadavg();
+    const char* slash = strchr(m_loadavg.data(), '/');
+    if (slash == NULL) THROW("Unexpected format of /proc/loadavg");
+    processCount.threads = strtoul(slash + 1, NULL, 10);
+
+    readStat();
+    for (char* p = m_stat.data(); *p; p = nextLine(p)) {
+        if (strncmp(p, "procs_", 6) != 0) continue;
+
+        unsigned long value;
+        if (strncmp(p + 6, "running ", 8) == 0) {
+            parseNumber(p + 14, value);
+            processCount.running = value;
+        }
+        else if (strncmp(p + 6, "blocked ", 8) == 0) {
+            parseNumber(p + 14, value);
+            processCount.blocked = value;
+        }
+    }
+
+    EntryCounter counter;
+    if (m_procDir < 0) openProcDir();
+    if (!forEachNumeric(m_procDir, m_dirents, counter)) THROW("Failed to list /proc: " + getSystemError());
+    processCount.total = counter.m_count;
+}
+
+void ProcBackend::getProcessStates(ProcessStates& states)
+{
+    states = ProcessStates();
+    StateCounter counter(states);
+    if (m_procDir < 0) openProcDir();
+    if (!forEachNumeric(m_procDir, m_dirents, counter)) THROW("Failed to list /proc: " + getSystemError());
+}
+
+void ProcBackend::readLoadavg()
+{
+    if (m_loadavgFresh) return;
+    read(m_loadavg);
+    m_loadavgFresh = true;
+}
+
+void ProcBackend::readStat()
+{
+    if (m_statFresh) return;
+    read(m_stat);
+    m_statFresh = true;
+}
+
+void ProcBackend::readMeminfo()
+{
+    static const KeyField KEYS[] = {
+        KEY_FIELD("MemTotal",     MI_TOTAL),
+        KEY_FIELD("MemFree",      MI_FREE),
+        KEY_FIELD("MemAvailable", MI_AVAILABLE),
+        KEY_FIELD("Buffers",      MI_BUFFERS),
+        KEY_FIELD("Cached",       MI_CACHED),
+        KEY_FIELD("Dirty",        MI_DIRTY),
+        KEY_FIELD("Writeback",    MI_WRITEBACK),
+        KEY_FIELD("SwapTotal",    MI_SWAP_TOTAL),
+        KEY_FIELD("SwapFree",     MI_SWAP_FREE)
+    };
+
+    if (m_meminfoFresh) return;
+    read(m_meminfo);
+    parseKeyValues(m_meminfo.data(), ':', KEYS, sizeof(KEYS) / sizeof(KEYS[0]), m_memInfo);
+    m_meminfoFresh = true;
+}
+
+void ProcBackend::readVmstat()
+{
+    static const KeyField KEYS[] = {
+        KEY_FIELD("pswpin",  VM_PSWPIN),
+        KEY_FIELD("pswpout", VM_PSWPOUT)
+    };
+
+    if (m_vmstatFresh) return;
+    read(m_vmstat);
+    parseKeyValues(m_vmstat.data(), ' ', KEYS, sizeof(KEYS) / sizeof(KEYS[0]), m_vmStat);
+    m_vmstatFresh = true;
+}
+
+} // namespace lincore
@@ -0,0 +1,114 @@
+/**********************************************
+   File:   proc_backend.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef PROC_BACKEND_H
+#define PROC_BACKEND_H
+
+#include "proc_reader.h"
+#include <vector>
+
+using std::vector;
+
+namespace lincore {
+
+struct LoadAverages;
+struct Memory;
+struct Swap;
+struct CPU;
+struct ProcessCount;
+struct ProcessStates;
+
+// Rows of the per-CPU table, in /proc/stat column order
+enum PerCPUField {
+    PC_USER, PC_NICE, PC_SYSTEM, PC_IDLE, PC_WAIT,
+    PC_IRQ, PC_SOFTIRQ, PC_STOLEN, PC_COUNT
+};
+
+// Rows of the scheduler table, the sched_info fields of /proc/schedstat
+enum SchedField { SS_RUN, SS_WAIT, SS_SLICES, SS_COUNT };
+
+/************************************
+ * Reads CPU, memory, swap and load averages straight from procfs,
+ * the same units libsigar reports plus the fields it drops. Every
+ * file is read at most once between two invalidate() calls, so
+ * memory and swap share one pass over /proc/meminfo.
+ ************************************/
+class ProcBackend
+{
+public:
+    ProcBackend();
+    ~ProcBackend();
+
+    // Start of a tick, the next getter re-reads its file
+    void invalidate();
+
+    void getLoadAverages(LoadAverages& systemLoad);
+    void getMemory(Memory& memory);
+    void getSwap(Swap& swap);
+    void getCPU(CPU& cpu);
+    // Times in ms of cpuN into table[field * cpus + N], CPUs that are
+    // offline or beyond cpus are left alone
+    void getPerCPU(double* table, size_t cpus);
+    // Needs a kernel with CONFIG_SCHED_INFO
+    bool hasSchedStat();
+    // Time on the CPU and waiting on its run queue in ms, and the
+    // timeslices run, of cpuN into table[field * cpus + N]
+    void getSchedStat(double* table, size_t cpus);
+    // Without walking /proc/<pid>: threads from /proc/loadavg, running
+    // and blocked from /proc/stat, processes by counting the numeric
+    // entries of /proc
+    void getProcessCount(ProcessCount& processCount);
+    // One read of /proc/<pid>/stat per process, meant for low rates
+    void getProcessStates(ProcessStates& states);
+
+private:
+    // /proc/meminfo in kB and the swap lines of /proc/vmstat
+    enum MemInfoField {
+        MI_TOTAL, MI_FREE, MI_AVAILABLE, MI_BUFFERS, MI_CACHED,
+        MI_DIRTY, MI_WRITEBACK, MI_SWAP_TOTAL, MI_SWAP_FREE, MI_COUNT
+    };
+    enum VmStatField { VM_PSWPIN, VM_PSWPOUT, VM_COUNT };
+
+private:
+    ProcReader m_stat;
+    ProcReader m_meminfo;
+    ProcReader m_vmstat;
+    ProcReader m_loadavg;
+    ProcReader m_schedstat;
+    bool m_statFresh;
+    bool m_meminfoFresh;
+    bool m_vmstatFresh;
+    bool m_loadavgFresh;
+    int m_procDir;
+    vector< char > m_dirents;
+    unsigned long m_memInfo[MI_COUNT];
+    unsigned long m_vmStat[VM_COUNT];
+    double m_msecPerTick;
+
+private:
+    void read(ProcReader& reader);
+    void readStat();
+    void readMeminfo();
+    void readVmstat();
+    void readLoadavg();
+    void openProcDir();
+};
+
+} // namespace lincore
+
+#endif // PROC_BACKEND_H
@@ -0,0 +1,222 @@
+/**********************************************
+   File:   proc_parse.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef PROC_PARSE_H
+#define PROC_PARSE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+/************************************
+ * Helpers for parsing procfs text in place. They never read past
+ * the terminating zero ProcReader puts after the data.
+ ************************************/
+namespace lincore {
+
+inline bool isDigit(char c)
+{
+    return (unsigned char) (c - '0') < 10;
+}
+
+inline char* skipBlanks(char* p)
+{
+    while ((*p == ' ') || (*p == '\t')) p++;
+    return p;
+}
+
+inline char* parseNumber(char* p, unsigned long& value)
+{
+    unsigned long v = 0;
+    for ( ; isDigit(*p); p++) v = v * 10 + (*p - '0');
+    value = v;
+    return p;
+}
+
+inline char* parseHex(char* p, unsigned long& value)
+{
+    unsigned long v = 0;
+    for (;;) {
+        char c = *p;
+        if (isDigit(c)) v = v * 16 + (c - '0');
+        else if ((c >= 'a') && (c <= 'f')) v = v * 16 + (c - 'a' + 10);
+        else break;
+        p++;
+    }
+    value = v;
+    return p;
+}
+
+// Start of the line after p, or the terminating zero
+inline char* nextLine(char* p)
+{
+    char* eol = strchr(p, '\n');
+    return (eol == NULL) ? p + strlen(p) : eol + 1;
+}
+
+// Storage I/O from /proc/<pid>/io, readable with the same user as
+// the process or CAP_SYS_PTRACE
+inline void parseProcIO(char* text, double& readBytes, double& writeBytes)
+{
+    for (char* p = text; *p; p = nextLine(p)) {
+        unsigned long value;
+        if (strncmp(p, "read_bytes: ", 12) == 0) {
+            parseNumber(p + 12, value);
+            readBytes = value;
+        }
+        else if (strncmp(p, "write_bytes: ", 13) == 0) {
+            parseNumber(p + 13, value);
+            writeBytes = value;
+        }
+    }
+}
+
+// The fields of /proc/<pid>/stat processes are measured by
+struct ProcStat
+{
+    char state;
+    unsigned long majorFaults;
+    unsigned long utime;        // clock ticks
+    unsigned long stime;
+    unsigned long startTime;    // clock ticks after boot
+    unsigned long rss;          // pages
+};
+
+// False if the text is cut short. The command may contain ") ",
+// the last one ends it.
+inline bool parseProcStat(char* text, ProcStat& stat)
+{
+    // Numbered as in proc(5), the state is field 3
+    enum { ST_STATE = 3, ST_MAJFLT = 12, ST_UTIME = 14, ST_STIME = 15,
+           ST_STARTTIME = 22, ST_RSS = 24 };
+
+    char* p = strrchr(text, ')');
+    if ((p == NULL) || (p[1] != ' ')) return false;
+    p += 2;
+    stat.state = *p;
+
+    for (int field = ST_STATE; field <= ST_RSS; field++) {
+        unsigned long value = 0;
+        parseNumber(p, value);
+        switch (field) {
+        case ST_MAJFLT:    stat.majorFaults = value; break;
+        case ST_UTIME:     stat.utime = value; break;
+        case ST_STIME:     stat.stime = value; break;
+        case ST_STARTTIME: stat.startTime = value; break;
+        case ST_RSS:       stat.rss = value; break;
+        }
+
+        p = strchr(p, ' ');
+        if (p == NULL) return false;
+        p++;
+    }
+    return true;
+}
+
+// Reads a small procfs file relative to a directory descriptor and
+// terminates it with a zero, false if it is gone or empty
+inline bool readAt(int dir, const char* path, char* buffer, size_t size)
+{
+    int fd = openat(dir, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    ssize_t n = ::read(fd, buffer, size - 1);
+    close(fd);
+    if (n <= 0) return false;
+    buffer[n] = '\0';
+    return true;
+}
+
+inline long monotonicMs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+// Process times in /proc count in clock ticks
+inline double msecPerTick()
+{
+    long hz = sysconf(_SC_CLK_TCK);
+    return 1000.0 / ((hz > 0) ? hz : 100);
+}
+
+// rss in /proc/<pid>/stat counts in pages
+inline long pageKb()
+{
+    long page = sysconf(_SC_PAGESIZE);
+    return ((page > 0) ? page : 4096) / 1024;
+}
+
+// Layout getdents64 fills in, glibc before 2.30 has no wrapper
+struct LinuxDirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+// Calls visit(name) for the numeric entries of a directory
+// descriptor, false if it could not be listed
+template< typename Visitor >
+inline bool forEachNumeric(int dir, std::vector< char >& buffer, Visitor& visit)
+{
+    if (lseek(dir, 0, SEEK_SET) < 0) return false;
+
+    for (;;) {
+        long n = syscall(SYS_getdents64, dir, &buffer[0], buffer.size());
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) return true;
+
+        for (long offset = 0; offset < n; ) {
+            const LinuxDirent64* entry = (const LinuxDirent64*) &buffer[offset];
+            offset += entry->d_reclen;
+            if (isDigit(entry->d_name[0])) visit(entry->d_name);
+        }
+    }
+}
+
+// Visitor of forEachNumeric() that counts the entries
+struct EntryCounter
+{
+    EntryCounter() : m_count(0) {}
+    void operator()(const char*) { m_count++; }
+    double m_count;
+};
+
+// Visitor of forEachNumeric() that keeps the numbers
+struct PidCollector
+{
+    explicit PidCollector(std::vector< int >& pids) : m_pids(pids) {}
+    void operator()(const char* name) { m_pids.push_back(atoi(name)); }
+    std::vector< int >& m_pids;
+};
+
+} // namespace lincore
+
+#endif // PROC_PARSE_H
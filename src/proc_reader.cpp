@@ -0,0 +1,122 @@
+/**********************************************
+   File:   proc_reader.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "proc_reader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace lincore {
+
+static size_t pageSize()
+{
+    static size_t size = (size_t) sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+ProcReader::ProcReader(const string& path) :
+    m_path(path), m_fd(-1), m_buffer(0), m_capacity(0), m_length(0)
+{
+}
+
+ProcReader::~ProcReader()
+{
+    close();
+    free(m_buffer);
+}
+
+void ProcReader::setPath(const string& path)
+{
+    if (path == m_path) return;
+    close();
+    m_path = path;
+}
+
+bool ProcReader::read()
+{
+    if ((m_buffer == 0) && !grow()) return false;
+
+    // Second attempt after reopening a file that went away
+    for (int attempt=0; attempt < 2; attempt++) {
+        if ((m_fd < 0) && !open()) return false;
+
+        size_t total = 0;
+        ssize_t n;
+        for (;;) {
+            n = pread(m_fd, m_buffer + total, m_capacity - 1 - total, total);
+            if (n > 0) {
+                total += n;
+                if ((total == m_capacity - 1) && !grow()) return false;
+                continue;
+            }
+            if ((n < 0) && (errno == EINTR)) continue;
+            break;
+        }
+
+        if (n == 0) {
+            m_buffer[total] = '\0';
+            m_length = total;
+            return true;
+        }
+
+        int error = errno;
+        close();
+        if ((error != ENOENT) && (error != ESTALE) && (error != ENODEV)) {
+            errno = error;
+            return false;
+        }
+    }
+    return false;
+}
+
+bool ProcReader::open()
+{
+    do {
+        m_fd = ::open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+    } while ((m_fd < 0) && (errno == EINTR));
+    return m_fd >= 0;
+}
+
+void ProcReader::close()
+{
+    if (m_fd < 0) return;
+    ::close(m_fd);
+    m_fd = -1;
+}
+
+bool ProcReader::grow()
+{
+    size_t capacity = (m_capacity == 0) ? pageSize() : m_capacity * 2;
+
+    void* buffer = 0;
+    if (posix_memalign(&buffer, pageSize(), capacity) != 0) {
+        errno = ENOMEM;
+        return false;
+    }
+    if (m_buffer != 0) {
+        memcpy(buffer, m_buffer, m_capacity);
+        free(m_buffer);
+    }
+    m_buffer = (char*) buffer;
+    m_capacity = capacity;
+    return true;
+}
+
+} // namespace lincore
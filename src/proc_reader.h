@@ -0,0 +1,70 @@
+/**********************************************
+   File:   proc_reader.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef PROC_READER_H
+#define PROC_READER_H
+
+#include <stddef.h>
+#include <string>
+
+using std::string;
+
+namespace lincore {
+
+/************************************
+ * A procfs or sysfs file kept open and re-read from offset 0 with
+ * pread() into a page aligned buffer that only grows. The file is
+ * reopened when its entry went away (ENOENT, ESTALE, ENODEV), for
+ * example after a device was removed and added back.
+ ************************************/
+class ProcReader
+{
+public:
+    ProcReader() : m_fd(-1), m_buffer(0), m_capacity(0), m_length(0) {}
+    explicit ProcReader(const string& path);
+    ~ProcReader();
+
+    void setPath(const string& path);
+    const string& path() { return m_path; }
+
+    // Reads the whole file, false with errno set on failure.
+    // The text is NUL terminated and may be modified in place,
+    // it stays valid until the next read().
+    bool read();
+    char* data() { return m_buffer; }
+    size_t length() { return m_length; }
+
+private:
+    string m_path;
+    int m_fd;
+    char* m_buffer;
+    size_t m_capacity;
+    size_t m_length;
+
+private:
+    ProcReader(const ProcReader&);
+    ProcReader& operator=(const ProcReader&);
+
+    bool open();
+    void close();
+    bool grow();
+};
+
+} // namespace lincore
+
+#endif // PROC_READER_H
@@ -0,0 +1,219 @@
+/**********************************************
+   File:   process_probe.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "process_probe.h"
+#include "proc_parse.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace lincore {
+
+static const size_t DIRENTS_BUFFER_SIZE = 32768;
+static const size_t STATUS_BUFFER_SIZE = 4096;
+
+// Sums the context switches in /proc/<pid>/task/<tid>/status and
+// notes the count of each thread, threads that exit meanwhile are skipped
+struct SwitchCounter
+{
+    SwitchCounter(int taskDir, vector< char >& buffer, vector< pair< int, double > >& seen) :
+        m_taskDir(taskDir), m_buffer(buffer), m_seen(seen), m_total(0) {}
+
+    void operator()(const char* tid) {
+        char path[64];
+        snprintf(path, sizeof(path), "%s/status", tid);
+        if (!readAt(m_taskDir, path, &m_buffer[0], m_buffer.size())) return;
+
+        // The voluntary line comes first, so the plain search finds it
+        static const char VOLUNTARY[] = "voluntary_ctxt_switches:";
+        static const char NONVOLUNTARY[] = "nonvoluntary_ctxt_switches:";
+        unsigned long voluntary;
+        unsigned long nonvoluntary;
+        char* p = strstr(&m_buffer[0], VOLUNTARY);
+        if (p == NULL) return;
+        parseNumber(skipBlanks(p + sizeof(VOLUNTARY) - 1), voluntary);
+        p = strstr(p, NONVOLUNTARY);
+        if (p == NULL) return;
+        parseNumber(skipBlanks(p + sizeof(NONVOLUNTARY) - 1), nonvoluntary);
+
+        double count = (double) voluntary + nonvoluntary;
+        m_seen.push_back(pair< int, double >(atoi(tid), count));
+        m_total += count;
+    }
+
+    int m_taskDir;
+    vector< char >& m_buffer;
+    vector< pair< int, double > >& m_seen;
+    double m_total;
+};
+
+static int openDir(const char* path)
+{
+    int fd;
+    do {
+        fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    } while ((fd < 0) && (errno == EINTR));
+    return fd;
+}
+
+ProcessProbe::ProcessProbe() :
+    m_pid(0), m_fdDir(-1), m_taskDir(-1), m_exitedSwitches(0), m_msecPerTick(msecPerTick()),
+    m_pageKb(pageKb())
+{
+}
+
+ProcessProbe::~ProcessProbe()
+{
+    detach();
+}
+
+bool ProcessProbe::attach(int pid)
+{
+    detach();
+    m_pid = pid;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    m_stat.setPath(path);
+    snprintf(path, sizeof(path), "/proc/%d/io", pid);
+    m_io.setPath(path);
+    snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", pid);
+    m_smaps.setPath(path);
+
+    // The stat descriptor is opened first and pins the process
+    ProcessUsage usage;
+    if (!readStat(usage)) {
+        detach();
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+    m_fdDir = openDir(path);
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    m_taskDir = openDir(path);
+
+    if (m_dirents.empty()) m_dirents.resize(DIRENTS_BUFFER_SIZE);
+    if (m_status.empty()) m_status.resize(STATUS_BUFFER_SIZE);
+    return true;
+}
+
+void ProcessProbe::detach()
+{
+    m_pid = 0;
+    m_stat.setPath("");
+    m_io.setPath("");
+    m_smaps.setPath("");
+    if (m_fdDir >= 0) close(m_fdDir);
+    if (m_taskDir >= 0) close(m_taskDir);
+    m_fdDir = -1;
+    m_taskDir = -1;
+    m_threads.clear();
+    m_exitedSwitches = 0;
+}
+
+bool ProcessProbe::read(ProcessUsage& usage)
+{
+    if (m_pid == 0) return false;
+
+    usage.clock = monotonicMs();
+    if (!readStat(usage)) return false;
+    readIO(usage);
+    readSmaps(usage);
+    usage.fds = countFds();
+    usage.ctxSwitches = countSwitches();
+    return true;
+}
+
+bool ProcessProbe::readStat(ProcessUsage& usage)
+{
+    ProcStat stat;
+    if (!m_stat.read() || !parseProcStat(m_stat.data(), stat)) return false;
+    if ((stat.state == 'Z') || (stat.state == 'X') || (stat.state == 'x')) return false;
+
+    usage.cpuTime = (stat.utime + stat.stime) * m_msecPerTick;
+    usage.majorFaults = stat.majorFaults;
+    usage.rss = (double) stat.rss * m_pageKb;
+    return true;
+}
+
+void ProcessProbe::readIO(ProcessUsage& usage)
+{
+    if (!m_io.read()) {
+        usage.readBytes = NAN;
+        usage.writeBytes = NAN;
+        return;
+    }
+    parseProcIO(m_io.data(), usage.readBytes, usage.writeBytes);
+}
+
+void ProcessProbe::readSmaps(ProcessUsage& usage)
+{
+    // smaps_rollup appeared in 4.14
+    usage.pss = NAN;
+    if (!m_smaps.read()) return;
+
+    for (char* p = m_smaps.data(); *p; p = nextLine(p)) {
+        if (strncmp(p, "Pss:", 4) != 0) continue;
+
+        unsigned long value;
+        parseNumber(skipBlanks(p + 4), value);
+        usage.pss = value;
+        break;
+    }
+}
+
+double ProcessProbe::countFds()
+{
+    if (m_fdDir < 0) return NAN;
+
+    EntryCounter counter;
+    if (!forEachNumeric(m_fdDir, m_dirents, counter)) return NAN;
+    return counter.m_count;
+}
+
+double ProcessProbe::countSwitches()
+{
+    // Each thread keeps its own counts, status of the PID has only
+    // those of the main thread
+    if (m_taskDir < 0) return NAN;
+
+    m_seen.clear();
+    SwitchCounter counter(m_taskDir, m_status, m_seen);
+    if (!forEachNumeric(m_taskDir, m_dirents, counter)) return NAN;
+    std::sort(m_seen.begin(), m_seen.end());
+
+    // A thread missing now exited, one whose count went back is a new
+    // thread under a reused TID; either way the old count is kept
+    size_t j = 0;
+    for (size_t i=0; i < m_threads.size(); i++) {
+        while ((j < m_seen.size()) && (m_seen[j].first < m_threads[i].first)) j++;
+        bool alive = (j < m_seen.size()) && (m_seen[j].first == m_threads[i].first) &&
+                     (m_seen[j].second >= m_threads[i].second);
+        if (!alive) m_exitedSwitches += m_threads[i].second;
+    }
+    m_threads.swap(m_seen);
+    return m_exitedSwitches + counter.m_total;
+}
+
+} // namespace lincore
@@ -0,0 +1,101 @@
+/**********************************************
+   File:   process_probe.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef PROCESS_PROBE_H
+#define PROCESS_PROBE_H
+
+#include "proc_reader.h"
+#include <utility>
+#include <vector>
+
+using std::pair;
+using std::vector;
+
+namespace lincore {
+
+// One reading of a process, counters are totals since it started
+struct ProcessUsage
+{
+    ProcessUsage() : clock(0), cpuTime(0), majorFaults(0), ctxSwitches(0),
+                     readBytes(0), writeBytes(0), rss(0), pss(0), fds(0) {}
+    double clock;           // ms of CLOCK_MONOTONIC at the reading
+    double cpuTime;         // ms in user and system mode
+    double majorFaults;
+    double ctxSwitches;     // voluntary and involuntary, of every thread, exited ones included
+    double readBytes;       // storage I/O from /proc/<pid>/io
+    double writeBytes;
+
+    // Gauges, NaN when the file is not readable
+    double rss;             // kB
+    double pss;             // kB, from smaps_rollup
+    double fds;
+};
+
+/************************************
+ * Reads the procfs files of one process. They stay open while the
+ * process is attached: a descriptor refers to the process it was
+ * opened for, so once that exits the reads fail with ESRCH even if
+ * the PID is taken again.
+ * The kernel keeps context switches per thread and drops them when
+ * the thread exits, the probe carries the last count of each thread
+ * that is gone so the process total never goes back.
+ ************************************/
+class ProcessProbe
+{
+public:
+    ProcessProbe();
+    ~ProcessProbe();
+
+    // False if the process is gone already
+    bool attach(int pid);
+    void detach();
+    int pid() { return m_pid; }
+
+    // False once the process exited or became a zombie
+    bool read(ProcessUsage& usage);
+
+private:
+    int m_pid;
+    ProcReader m_stat;
+    ProcReader m_io;
+    ProcReader m_smaps;
+    int m_fdDir;
+    int m_taskDir;
+    vector< char > m_dirents;
+    vector< char > m_status;
+    // Last count of every thread by TID, sorted, and the ones read now
+    vector< pair< int, double > > m_threads;
+    vector< pair< int, double > > m_seen;
+    double m_exitedSwitches;
+    double m_msecPerTick;
+    long m_pageKb;
+
+private:
+    ProcessProbe(const ProcessProbe&);
+    ProcessProbe& operator=(const ProcessProbe&);
+
+    bool readStat(ProcessUsage& usage);
+    void readIO(ProcessUsage& usage);
+    void readSmaps(ProcessUsage& usage);
+    double countFds();
+    double countSwitches();
+};
+
+} // namespace lincore
+
+#endif // PROCESS_PROBE_H
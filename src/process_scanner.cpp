@@ -0,0 +1,387 @@
+/**********************************************
+   File:   process_scanner.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "process_scanner.h"
+#include "proc_parse.h"
+#include "utils/exception.h"
+#include "utils/log.h"
+#include "utils/misc.h"
+#include <algorithm>
+#include <ctype.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace cdb;
+
+namespace lincore {
+
+static const size_t DIRENTS_BUFFER_SIZE = 32768;
+// Names of processes long gone are dropped past this many
+static const size_t MAX_GROUP_NAMES = 4096;
+
+ProcessScanner::ProcessScanner() :
+    m_procDir(-1), m_count(0), m_io(false), m_groupBy(GROUP_NONE), m_msecPerTick(msecPerTick()),
+    m_pageKb(pageKb()), m_clock(0), m_interval(0), m_pass(0)
+{
+}
+
+ProcessScanner::~ProcessScanner()
+{
+    stop();
+    for (size_t i=0; i < m_shards.size(); i++) delete m_shards[i];
+    if (m_procDir >= 0) close(m_procDir);
+}
+
+void ProcessScanner::start(size_t count, int shards, bool io)
+{
+    m_procDir = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (m_procDir < 0) THROW("Failed to open /proc: " + getSystemError());
+    m_dirents.resize(DIRENTS_BUFFER_SIZE);
+
+    m_count = count;
+    m_io = io;
+    for (int i=0; i < shards; i++) {
+        m_shards.push_back(new Shard(*this, i));
+    }
+    m_pool.start(shards);
+}
+
+void ProcessScanner::stop()
+{
+    m_pool.stop();
+}
+
+bool ProcessScanner::busy()
+{
+    // Collect the shards that finished after an earlier pass gave up
+    // on them. After stop() the late ones count as out for good.
+    for (Job* job; (job = m_pool.finished(0)) != 0; ) {
+        ((Shard*) job)->m_inFlight = false;
+    }
+    for (size_t i=0; i < m_shards.size(); i++) {
+        if (m_shards[i]->m_inFlight) return true;
+    }
+    return false;
+}
+
+bool ProcessScanner::scan(int timeoutMs)
+{
+    // The PIDs are not listed again while a shard still reads them
+    if (busy()) return false;
+
+    long now = monotonicMs();
+    m_interval = (m_clock > 0) ? now - m_clock : 0;
+    m_clock = now;
+    m_pass++;
+    if (!list()) {
+        m_clock = 0;
+        return false;
+    }
+
+    size_t submitted = 0;
+    for (size_t i=0; i < m_shards.size(); i++) {
+        Shard* shard = m_shards[i];
+        shard->m_pass = m_pass;
+        shard->m_inFlight = true;
+        if (m_pool.submit(shard)) {
+            submitted++;
+        }
+        else {
+            shard->m_inFlight = false;
+        }
+    }
+
+    long deadline = now + timeoutMs;
+    size_t done = 0;
+    while (done < submitted) {
+        long left = deadline - monotonicMs();
+        if (left <= 0) break;
+        // The wait also ends early on a stray wake-up or a signal
+        Job* job = m_pool.finished((int) left);
+        if (job == 0) continue;
+        ((Shard*) job)->m_inFlight = false;
+        done++;
+    }
+
+    if (done < m_shards.size()) {
+        LOG_WARN << "Scan of /proc did not finish in " << timeoutMs << "ms, "
+                 << m_shards.size() - done << " of " << m_shards.size() << " shards are late";
+        // Rates over a pass with holes would be off
+        m_clock = 0;
+        return false;
+    }
+    return true;
+}
+
+void ProcessScanner::getTop(TopKind kind, TopEntry* entries)
+{
+    m_merged.clear();
+    for (size_t i=0; i < m_shards.size(); i++) {
+        const vector< Candidate >& heap = m_shards[i]->m_heaps[kind];
+        m_merged.insert(m_merged.end(), heap.begin(), heap.end());
+    }
+
+    size_t ranked = std::min(m_count, m_merged.size());
+    std::partial_sort(m_merged.begin(), m_merged.begin() + ranked, m_merged.end(), greaterValue);
+
+    for (size_t i=0; i < m_count; i++) {
+        if (i < ranked) {
+            entries[i] = m_merged[i].m_entry;
+            continue;
+        }
+        entries[i].pid = NAN;
+        entries[i].cpu = NAN;
+        entries[i].rss = NAN;
+        entries[i].io = NAN;
+    }
+}
+
+const GroupTotals& ProcessScanner::getGroups()
+{
+    m_totals.clear();
+    for (size_t i=0; i < m_shards.size(); i++) {
+        const Shard* shard = m_shards[i];
+        boost::unordered_map< const string*, GroupUsage >::const_iterator it = shard->m_groups.begin();
+        for ( ; it != shard->m_groups.end(); ++it) {
+            std::pair< GroupTotals::iterator, bool > slot = m_totals.insert(std::make_pair(*it->first, it->second));
+            if (slot.second) continue;
+
+            GroupUsage& total = slot.first->second;
+            total.processes += it->second.processes;
+            total.cpu += it->second.cpu;
+            total.rss += it->second.rss;
+            total.majorFaults += it->second.majorFaults;
+            total.io += it->second.io;
+        }
+    }
+    return m_totals;
+}
+
+bool ProcessScanner::list()
+{
+    m_pids.clear();
+    PidCollector collect(m_pids);
+    if (!forEachNumeric(m_procDir, m_dirents, collect)) {
+        LOG_WARN << "Failed to list /proc: " << getSystemError();
+        return false;
+    }
+    return true;
+}
+
+bool ProcessScanner::greaterValue(const Candidate& left, const Candidate& right)
+{
+    return left.m_value > right.m_value;
+}
+
+void ProcessScanner::Shard::run()
+{
+    for (int kind=0; kind < TOP_COUNT; kind++) {
+        m_heaps[kind].clear();
+    }
+    m_groups.clear();
+    if (m_names.size() > MAX_GROUP_NAMES) {
+        m_names.clear();
+        for (Samples::iterator it = m_samples.begin(); it != m_samples.end(); ++it) {
+            it->second.m_group = NULL;
+        }
+    }
+
+    size_t shards = m_scanner.m_shards.size();
+    double interval = m_scanner.m_interval;
+    const vector< int >& pids = m_scanner.m_pids;
+
+    for (size_t i=0; i < pids.size(); i++) {
+        int pid = pids[i];
+        if ((size_t) pid % shards != (size_t) m_index) continue;
+
+        Sample current;
+        TopEntry entry;
+        if (!read(pid, current, entry)) continue;
+        current.m_pass = m_pass;
+
+        std::pair< Samples::iterator, bool > slot = m_samples.insert(std::make_pair(pid, current));
+        Sample& previous = slot.first->second;
+        // The PID may belong to another process by now. One that was
+        // not there last pass did all of its work since.
+        bool known = !slot.second && (previous.m_startTime == current.m_startTime);
+
+        // The cgroup is read once per process
+        if (m_scanner.m_groupBy == GROUP_CGROUP) {
+            current.m_group = (known && (previous.m_group != NULL)) ? previous.m_group : readCgroup(pid);
+        }
+        if (current.m_group != NULL) {
+            add(current.m_group, current, known ? &previous : NULL, entry, interval);
+        }
+
+        // Complete before it goes to any ranking, the rss one too
+        // reports cpu and io
+        if (interval > 0) {
+            double cpuTime = known ? current.m_cpuTime - previous.m_cpuTime : current.m_cpuTime;
+            entry.cpu = cpuTime * 100 / interval;
+            if (m_scanner.m_io) {
+                double ioBytes = known ? current.m_ioBytes - previous.m_ioBytes : current.m_ioBytes;
+                entry.io = ioBytes * 1000 / interval;
+            }
+        }
+        offer(TOP_RSS, entry.rss, entry);
+        offer(TOP_CPU, entry.cpu, entry);
+        if (m_scanner.m_io) offer(TOP_IO, entry.io, entry);
+        previous = current;
+    }
+
+    // Forget the processes that are gone
+    for (Samples::iterator it = m_samples.begin(); it != m_samples.end(); ) {
+        if (it->second.m_pass != m_pass) {
+            it = m_samples.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+bool ProcessScanner::Shard::read(int pid, Sample& sample, TopEntry& entry)
+{
+    char path[32];
+    snprintf(path, sizeof(path), "%d/stat", pid);
+    if (!readAt(m_scanner.m_procDir, path, m_buffer, sizeof(m_buffer))) return false;
+
+    ProcStat stat;
+    if (!parseProcStat(m_buffer, stat)) return false;
+    if ((stat.state == 'Z') || (stat.state == 'X') || (stat.state == 'x')) return false;
+
+    sample.m_startTime = stat.startTime;
+    sample.m_cpuTime = (stat.utime + stat.stime) * m_scanner.m_msecPerTick;
+    sample.m_majorFaults = stat.majorFaults;
+    // Before readIO(), which reuses the buffer
+    sample.m_group = NULL;
+    if (m_scanner.m_groupBy == GROUP_COMM) {
+        sample.m_group = intern(strchr(m_buffer, '(') + 1, strrchr(m_buffer, ')'));
+    }
+    sample.m_ioBytes = m_scanner.m_io ? readIO(pid) : NAN;
+
+    entry.pid = pid;
+    entry.cpu = NAN;
+    entry.rss = (double) stat.rss * m_scanner.m_pageKb;
+    entry.io = NAN;
+    return true;
+}
+
+double ProcessScanner::Shard::readIO(int pid)
+{
+    char path[32];
+    snprintf(path, sizeof(path), "%d/io", pid);
+    if (!readAt(m_scanner.m_procDir, path, m_buffer, sizeof(m_buffer))) return NAN;
+
+    double readBytes = 0;
+    double writeBytes = 0;
+    parseProcIO(m_buffer, readBytes, writeBytes);
+    return readBytes + writeBytes;
+}
+
+const string* ProcessScanner::Shard::readCgroup(int pid)
+{
+    char path[32];
+    snprintf(path, sizeof(path), "%d/cgroup", pid);
+    if (!readAt(m_scanner.m_procDir, path, m_buffer, sizeof(m_buffer))) return NULL;
+
+    // hierarchy-ID:controllers:path, the unified hierarchy is 0::,
+    // on v1 alone the systemd one names the services
+    char* line = NULL;
+    for (char* p = m_buffer; *p; p = nextLine(p)) {
+        if (strncmp(p, "0::", 3) == 0) {
+            line = p;
+            break;
+        }
+        if ((line == NULL) || (strstr(p, ":name=systemd:") != NULL)) line = p;
+    }
+    if (line == NULL) return NULL;
+
+    char* end = strchr(line, '\n');
+    if (end == NULL) end = line + strlen(line);
+    *end = '\0';
+    char* slash = strrchr(line, '/');
+    if (slash == NULL) return NULL;
+    if (slash[1] == '\0') return intern("root", NULL);
+    return intern(slash + 1, end);
+}
+
+// The name with anything but letters and digits turned into '_',
+// end is NULL for a C string
+const string* ProcessScanner::Shard::intern(const char* begin, const char* end)
+{
+    m_name.clear();
+    for (const char* p = begin; (end == NULL) ? (*p != '\0') : (p < end); p++) {
+        m_name += isalnum((unsigned char) *p) ? *p : '_';
+    }
+    if (m_name.empty()) m_name = "_";
+    return &*m_names.insert(m_name).first;
+}
+
+// Changes since the previous pass, everything if the process is new
+void ProcessScanner::Shard::add(const string* group, const Sample& current, const Sample* previous,
+                                const TopEntry& entry, double interval)
+{
+    std::pair< boost::unordered_map< const string*, GroupUsage >::iterator, bool > slot =
+        m_groups.insert(std::make_pair(group, GroupUsage()));
+    GroupUsage& usage = slot.first->second;
+    if (slot.second && (interval <= 0)) {
+        usage.cpu = NAN;
+        usage.majorFaults = NAN;
+        usage.io = NAN;
+    }
+
+    usage.processes++;
+    usage.rss += entry.rss;
+    if (interval <= 0) return;
+
+    double cpuTime = current.m_cpuTime - (previous ? previous->m_cpuTime : 0);
+    usage.cpu += cpuTime * 100 / interval;
+    double faults = current.m_majorFaults - (previous ? previous->m_majorFaults : 0);
+    usage.majorFaults += faults * 1000 / interval;
+    // Processes of other users may not be readable
+    double base = previous ? previous->m_ioBytes : 0;
+    if ((current.m_ioBytes == current.m_ioBytes) && (base == base)) {
+        usage.io += (current.m_ioBytes - base) * 1000 / interval;
+    }
+}
+
+void ProcessScanner::Shard::offer(TopKind kind, double value, const TopEntry& entry)
+{
+    // Idle processes and unreadable counters are not ranked
+    if (!(value > 0) || (m_scanner.m_count == 0)) return;
+
+    vector< Candidate >& heap = m_heaps[kind];
+    if (heap.size() == m_scanner.m_count) {
+        if (value <= heap.front().m_value) return;
+        std::pop_heap(heap.begin(), heap.end(), greaterValue);
+        heap.pop_back();
+    }
+
+    Candidate candidate;
+    candidate.m_value = value;
+    candidate.m_entry = entry;
+    heap.push_back(candidate);
+    std::push_heap(heap.begin(), heap.end(), greaterValue);
+}
+
+} // namespace lincore
@@ -0,0 +1,180 @@
+/**********************************************
+   File:   process_scanner.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef PROCESS_SCANNER_H
+#define PROCESS_SCANNER_H
+
+#include "worker_pool.h"
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace lincore {
+
+enum TopKind
+{
+    TOP_CPU,
+    TOP_RSS,
+    TOP_IO,
+    TOP_COUNT
+};
+
+// A process in a top list, NaN where it is not known
+struct TopEntry
+{
+    TopEntry() : pid(0), cpu(0), rss(0), io(0) {}
+    double pid;
+    double cpu;     // percent of one CPU
+    double rss;     // kB
+    double io;      // storage bytes read and written per second
+};
+
+enum GroupBy
+{
+    GROUP_NONE,
+    GROUP_COMM,     // command name from stat
+    GROUP_CGROUP    // last component of the cgroup path
+};
+
+// Totals of the processes of a group, rates are NaN on the first pass
+struct GroupUsage
+{
+    GroupUsage() : processes(0), cpu(0), rss(0), majorFaults(0), io(0) {}
+    double processes;
+    double cpu;             // percent of one CPU
+    double rss;             // kB
+    double majorFaults;     // per second
+    double io;              // storage bytes read and written per second
+};
+
+// Group names contain only letters, digits and '_'
+typedef boost::unordered_map< string, GroupUsage > GroupTotals;
+
+/************************************
+ * Finds the processes using the most CPU, memory or I/O with one
+ * pass over /proc. The PIDs are split by PID modulo the number of
+ * shards, each shard runs on a thread of its own, reads stat (and io)
+ * with openat() relative to a /proc descriptor that stays open, keeps
+ * the previous readings of its own PIDs and a bounded heap per
+ * ranking. The collector merges the heaps.
+ * Processes may also be summed up by group, each shard keeps the
+ * group names interned and totals keyed by them.
+ * A shard left behind by scan() reads the fields of the scanner,
+ * the owner must not destroy it while busy().
+ ************************************/
+class ProcessScanner
+{
+public:
+    ProcessScanner();
+    ~ProcessScanner();
+
+    void setGroupBy(GroupBy groupBy) { m_groupBy = groupBy; }
+    // count entries per ranking, io adds reads of /proc/<pid>/io
+    void start(size_t count, int shards, bool io);
+    void stop();
+    bool started() { return m_pool.started(); }
+    // True while a shard is still out on a worker
+    bool busy();
+
+    // One pass, false if /proc could not be listed or a shard did
+    // not finish within the timeout
+    bool scan(int timeoutMs);
+    // count entries, the busiest first, blank past the last process
+    void getTop(TopKind kind, TopEntry* entries);
+    // The groups with a process in the last pass
+    const GroupTotals& getGroups();
+
+private:
+    struct Sample
+    {
+        unsigned long m_startTime;
+        double m_cpuTime;
+        double m_ioBytes;
+        double m_majorFaults;
+        const string* m_group;  // interned by the shard, cgroup only
+        unsigned int m_pass;
+    };
+    typedef boost::unordered_map< int, Sample > Samples;
+
+    struct Candidate
+    {
+        double m_value;
+        TopEntry m_entry;
+    };
+
+    class Shard : public Job
+    {
+    public:
+        Shard(ProcessScanner& scanner, int index) :
+            m_scanner(scanner), m_index(index), m_pass(0), m_inFlight(false) {}
+        virtual void run();
+
+        ProcessScanner& m_scanner;
+        int m_index;
+        unsigned int m_pass;
+        bool m_inFlight;
+        Samples m_samples;
+        vector< Candidate > m_heaps[TOP_COUNT];
+        boost::unordered_set< string > m_names;
+        boost::unordered_map< const string*, GroupUsage > m_groups;
+        string m_name;
+        char m_buffer[1024];
+
+    private:
+        bool read(int pid, Sample& sample, TopEntry& entry);
+        double readIO(int pid);
+        const string* readCgroup(int pid);
+        const string* intern(const char* begin, const char* end);
+        void offer(TopKind kind, double value, const TopEntry& entry);
+        void add(const string* group, const Sample& current, const Sample* previous,
+                 const TopEntry& entry, double interval);
+    };
+
+private:
+    WorkerPool m_pool;
+    vector< Shard* > m_shards;
+    int m_procDir;
+    vector< char > m_dirents;
+    vector< int > m_pids;
+    size_t m_count;
+    bool m_io;
+    GroupBy m_groupBy;
+    double m_msecPerTick;
+    long m_pageKb;
+    long m_clock;           // ms, monotonic, of the current pass
+    long m_interval;        // ms since the previous pass, 0 on the first
+    unsigned int m_pass;
+    vector< Candidate > m_merged;
+    GroupTotals m_totals;
+
+private:
+    ProcessScanner(const ProcessScanner&);
+    ProcessScanner& operator=(const ProcessScanner&);
+
+    bool list();
+    // Orders the heaps with the smallest value on top
+    static bool greaterValue(const Candidate& left, const Candidate& right);
+};
+
+} // namespace lincore
+
+#endif // PROCESS_SCANNER_H
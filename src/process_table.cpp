@@ -0,0 +1,371 @@
+/**********************************************
+   File:   process_table.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "process_table.h"
+#include "proc_parse.h"
+#include "utils/exception.h"
+#include "utils/log.h"
+#include "utils/misc.h"
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace cdb;
+
+namespace lincore {
+
+static const size_t RECEIVE_BUFFER_SIZE = 16384;
+static const size_t DIRENTS_BUFFER_SIZE = 32768;
+static const size_t CMDLINE_BUFFER_SIZE = 4096;
+static const size_t MAX_CMDLINE = 131072;
+// Room for the events of a burst of forks between two ticks
+static const int SOCKET_BUFFER_SIZE = 4 << 20;
+static const int ACK_TIMEOUT_MS = 1000;
+
+// The events read here, the kernel may know larger ones
+static const size_t MIN_EVENT_SIZE =
+    offsetof(struct proc_event, event_data) + sizeof(((struct proc_event*) 0)->event_data.fork);
+
+ProcessTable::~ProcessTable()
+{
+    closeSocket();
+    if (m_procDir >= 0) close(m_procDir);
+}
+
+void ProcessTable::setFilters(const ProcessFilters& filters)
+{
+    m_filters.assign(filters.begin(), filters.end());
+    m_matches.assign(m_filters.size(), set< int >());
+}
+
+void ProcessTable::start()
+{
+    m_procDir = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (m_procDir < 0) THROW("Failed to open /proc: " + getSystemError());
+    m_dirents.resize(DIRENTS_BUFFER_SIZE);
+    m_cmdline.resize(CMDLINE_BUFFER_SIZE);
+
+    // Subscribed before the listing, so no process falls in between
+    if (!subscribe()) {
+        LOG_WARN << "Process events are not available: " << getSystemError()
+                 << ", /proc is listed every " << m_rescanMs / 1000 << "s";
+    }
+    scan();
+    m_nextScan = monotonicMs() + m_rescanMs;
+}
+
+bool ProcessTable::update()
+{
+    if (connected()) {
+        receive();
+        if (m_resync) {
+            m_resync = false;
+            scan();
+        }
+    }
+    else if (monotonicMs() >= m_nextScan) {
+        rescan();
+        m_nextScan = monotonicMs() + m_rescanMs;
+    }
+
+    bool changed = m_changed;
+    m_changed = false;
+    return changed;
+}
+
+void ProcessTable::getProcessIDs(ProcessIDs& procs)
+{
+    for (size_t i=0; i < m_filters.size(); i++) {
+        if (m_matches[i].empty()) continue;
+        ProcessID processID = { m_filters[i].id, *m_matches[i].begin() };
+        procs.push_back(processID);
+    }
+}
+
+bool ProcessTable::subscribe()
+{
+    m_socket = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_CONNECTOR);
+    if (m_socket < 0) return false;
+    m_buffer.resize(RECEIVE_BUFFER_SIZE);
+
+    int size = SOCKET_BUFFER_SIZE;
+    if (setsockopt(m_socket, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) != 0) {
+        setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    struct sockaddr_nl local;
+    memset(&local, 0, sizeof(local));
+    local.nl_family = AF_NETLINK;
+    local.nl_groups = CN_IDX_PROC;
+    if (bind(m_socket, (struct sockaddr*) &local, sizeof(local)) != 0) {
+        closeSocket();
+        return false;
+    }
+
+    char request[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))];
+    memset(request, 0, sizeof(request));
+    struct nlmsghdr* header = (struct nlmsghdr*) request;
+    header->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op));
+    header->nlmsg_type = NLMSG_DONE;
+    struct cn_msg* message = (struct cn_msg*) NLMSG_DATA(header);
+    message->id.idx = CN_IDX_PROC;
+    message->id.val = CN_VAL_PROC;
+    message->len = sizeof(enum proc_cn_mcast_op);
+    *(enum proc_cn_mcast_op*) message->data = PROC_CN_MCAST_LISTEN;
+
+    if (send(m_socket, request, header->nlmsg_len, 0) < 0) {
+        closeSocket();
+        return false;
+    }
+
+    // The kernel acknowledges with an event that carries the error.
+    // Outside of the initial network namespace nothing comes back.
+    long deadline = monotonicMs() + ACK_TIMEOUT_MS;
+    for (;;) {
+        long left = deadline - monotonicMs();
+        struct pollfd ready = { m_socket, POLLIN, 0 };
+        int n = (left > 0) ? poll(&ready, 1, (int) left) : 0;
+        if ((n < 0) && (errno == EINTR)) continue;
+        if (n <= 0) {
+            closeSocket();
+            errno = ETIMEDOUT;
+            return false;
+        }
+
+        ssize_t length = recv(m_socket, &m_buffer[0], m_buffer.size(), 0);
+        if (length <= 0) continue;
+
+        // Events before the acknowledgement are covered by the listing
+        size_t remaining = length;
+        header = (struct nlmsghdr*) &m_buffer[0];
+        for ( ; NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining)) {
+            if (header->nlmsg_len < NLMSG_LENGTH(sizeof(struct cn_msg) + MIN_EVENT_SIZE)) continue;
+            message = (struct cn_msg*) NLMSG_DATA(header);
+            const struct proc_event* event = (const struct proc_event*) message->data;
+            if (event->what != proc_event::PROC_EVENT_NONE) continue;
+
+            if (event->event_data.ack.err != 0) {
+                closeSocket();
+                errno = event->event_data.ack.err;
+                return false;
+            }
+            return true;
+        }
+    }
+}
+
+void ProcessTable::closeSocket()
+{
+    if (m_socket < 0) return;
+    ::close(m_socket);
+    m_socket = -1;
+}
+
+void ProcessTable::receive()
+{
+    for (;;) {
+        ssize_t n = recv(m_socket, &m_buffer[0], m_buffer.size(), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // Events were dropped, the table is built again from /proc
+            if (errno == ENOBUFS) {
+                m_resync = true;
+                continue;
+            }
+            return;
+        }
+        if (n == 0) return;
+
+        size_t length = n;
+        struct nlmsghdr* header = (struct nlmsghdr*) &m_buffer[0];
+        for ( ; NLMSG_OK(header, length); header = NLMSG_NEXT(header, length)) {
+            if ((header->nlmsg_type == NLMSG_ERROR) || (header->nlmsg_type == NLMSG_NOOP)) continue;
+            if (header->nlmsg_len < NLMSG_LENGTH(sizeof(struct cn_msg) + MIN_EVENT_SIZE)) continue;
+
+            const struct cn_msg* message = (const struct cn_msg*) NLMSG_DATA(header);
+            if ((message->id.idx != CN_IDX_PROC) || (message->id.val != CN_VAL_PROC)) continue;
+            handle(message->data);
+        }
+    }
+}
+
+void ProcessTable::handle(const void* data)
+{
+    // Threads are reported as well, only thread group leaders count
+    const struct proc_event* event = (const struct proc_event*) data;
+    switch (event->what) {
+    case proc_event::PROC_EVENT_FORK:
+        if (event->event_data.fork.child_pid == event->event_data.fork.child_tgid) {
+            inherit(event->event_data.fork.parent_tgid, event->event_data.fork.child_pid);
+        }
+        break;
+    case proc_event::PROC_EVENT_EXEC:
+        match(event->event_data.exec.process_tgid);
+        break;
+    case proc_event::PROC_EVENT_COMM:
+        if (event->event_data.comm.process_pid == event->event_data.comm.process_tgid) {
+            match(event->event_data.comm.process_pid);
+        }
+        break;
+    case proc_event::PROC_EVENT_EXIT:
+        if (event->event_data.exit.process_pid == event->event_data.exit.process_tgid) {
+            forget(event->event_data.exit.process_pid);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+bool ProcessTable::list(vector< int >& pids)
+{
+    pids.clear();
+    PidCollector collect(pids);
+    if (!forEachNumeric(m_procDir, m_dirents, collect)) {
+        LOG_WARN << "Failed to list /proc: " << getSystemError();
+        return false;
+    }
+    std::sort(pids.begin(), pids.end());
+    return true;
+}
+
+void ProcessTable::scan()
+{
+    for (size_t i=0; i < m_matches.size(); i++) {
+        if (m_matches[i].empty()) continue;
+        m_matches[i].clear();
+        m_changed = true;
+    }
+
+    if (!list(m_pids)) return;
+    for (size_t i=0; i < m_pids.size(); i++) match(m_pids[i]);
+}
+
+void ProcessTable::rescan()
+{
+    if (!list(m_listing)) return;
+
+    // PIDs only in the previous listing are gone, only in the new one started
+    size_t i = 0;
+    size_t j = 0;
+    while ((i < m_pids.size()) || (j < m_listing.size())) {
+        if ((j == m_listing.size()) || ((i < m_pids.size()) && (m_pids[i] < m_listing[j]))) {
+            forget(m_pids[i++]);
+        }
+        else if ((i == m_pids.size()) || (m_listing[j] < m_pids[i])) {
+            match(m_listing[j++]);
+        }
+        else {
+            i++;
+            j++;
+        }
+    }
+    m_pids.swap(m_listing);
+}
+
+void ProcessTable::match(int pid)
+{
+    // A new program replaces the matches of the old one
+    forget(pid);
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    char comm[64];
+    ssize_t n = ::read(fd, comm, sizeof(comm) - 1);
+    close(fd);
+    if (n <= 0) return;
+    if (comm[n - 1] == '\n') n--;
+    comm[n] = '\0';
+
+    size_t length = 0;
+    bool loaded = false;
+    for (size_t i=0; i < m_filters.size(); i++) {
+        if (m_filters[i].exec != comm) continue;
+        if (!loaded) {
+            if (!readCmdline(pid, length)) return;
+            loaded = true;
+        }
+
+        // Same rule as SigarIface::getProcessIDs(): one of the
+        // NUL separated arguments contains the text
+        const char* args = m_filters[i].args.c_str();
+        for (const char* p = &m_cmdline[0]; p < &m_cmdline[0] + length; p += strlen(p) + 1) {
+            if (strstr(p, args) == NULL) continue;
+            m_matches[i].insert(pid);
+            m_changed = true;
+            break;
+        }
+    }
+}
+
+bool ProcessTable::readCmdline(int pid, size_t& length)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/cmdline", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    length = 0;
+    for (;;) {
+        if (length == m_cmdline.size() - 1) {
+            // Arguments past the cap are not matched
+            if (m_cmdline.size() >= MAX_CMDLINE) break;
+            m_cmdline.resize(m_cmdline.size() * 2);
+        }
+        ssize_t n = ::read(fd, &m_cmdline[length], m_cmdline.size() - 1 - length);
+        if ((n < 0) && (errno == EINTR)) continue;
+        if (n <= 0) break;
+        length += n;
+    }
+    close(fd);
+
+    m_cmdline[length] = '\0';
+    return true;
+}
+
+void ProcessTable::forget(int pid)
+{
+    for (size_t i=0; i < m_matches.size(); i++) {
+        if (m_matches[i].erase(pid) != 0) m_changed = true;
+    }
+}
+
+void ProcessTable::inherit(int parent, int child)
+{
+    // The child runs the program of the parent until it calls exec
+    for (size_t i=0; i < m_matches.size(); i++) {
+        if (m_matches[i].count(parent) == 0) continue;
+        m_matches[i].insert(child);
+        m_changed = true;
+    }
+}
+
+} // namespace lincore
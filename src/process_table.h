@@ -0,0 +1,97 @@
+/**********************************************
+   File:   process_table.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef PROCESS_TABLE_H
+#define PROCESS_TABLE_H
+
+#include "sigar_iface.h"
+#include <set>
+#include <vector>
+
+using std::set;
+using std::vector;
+
+namespace lincore {
+
+/************************************
+ * The processes matching a list of filters, kept up to date from
+ * proc connector events. A process is matched when it starts a
+ * program or renames itself. A fork inherits the matches of its
+ * parent and an exit removes the process, so the work grows with
+ * the churn and not with the number of processes.
+ * The connector needs CAP_NET_ADMIN in the initial namespaces.
+ * Without it the PIDs in /proc are compared with the previous
+ * listing every rescan interval. In that mode a process that
+ * starts another program without forking is not rematched.
+ ************************************/
+class ProcessTable
+{
+public:
+    ProcessTable() : m_socket(-1), m_procDir(-1), m_rescanMs(0), m_nextScan(0),
+                     m_resync(false), m_changed(false) {}
+    ~ProcessTable();
+
+    // Filter ids are reported back by getProcessIDs()
+    void setFilters(const ProcessFilters& filters);
+    void setRescan(int seconds) { m_rescanMs = seconds * 1000L; }
+
+    // Subscribes to the connector and matches every process once
+    void start();
+    bool connected() { return m_socket >= 0; }
+
+    // Applies what happened since the last call, true if a process
+    // started or stopped matching
+    bool update();
+    // The lowest matching PID of every filter with a match
+    void getProcessIDs(ProcessIDs& procs);
+
+private:
+    vector< ProcessFilter > m_filters;
+    vector< set< int > > m_matches;     // PIDs of each filter
+    int m_socket;
+    int m_procDir;
+    vector< char > m_buffer;
+    vector< char > m_dirents;
+    vector< char > m_cmdline;
+    vector< int > m_pids;               // last listing, sorted
+    vector< int > m_listing;
+    long m_rescanMs;
+    long m_nextScan;
+    bool m_resync;                      // events were lost
+    bool m_changed;
+
+private:
+    ProcessTable(const ProcessTable&);
+    ProcessTable& operator=(const ProcessTable&);
+
+    bool subscribe();
+    void closeSocket();
+    void receive();
+    void handle(const void* event);
+    bool list(vector< int >& pids);
+    void scan();
+    void rescan();
+    void match(int pid);
+    bool readCmdline(int pid, size_t& length);
+    void forget(int pid);
+    void inherit(int parent, int child);
+};
+
+} // namespace lincore
+
+#endif // PROCESS_TABLE_H
@@ -0,0 +1,140 @@
+/**********************************************
+   File:   row_formatter.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "row_formatter.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace lincore {
+
+static const int MAX_PRECISION = 9;
+
+static const uint64_t POW10[MAX_PRECISION + 1] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL,
+    1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL
+};
+
+// Above this the scaled value may not fit into 64 bits
+static const double MAX_EXACT = 1e18;
+
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+char* formatInteger(char* p, uint64_t value)
+{
+    char tmp[24];
+    char* t = tmp + sizeof(tmp);
+
+    while (value >= 100) {
+        unsigned int pair = (unsigned int) (value % 100) * 2;
+        value /= 100;
+        *--t = DIGIT_PAIRS[pair + 1];
+        *--t = DIGIT_PAIRS[pair];
+    }
+    if (value >= 10) {
+        unsigned int pair = (unsigned int) value * 2;
+        *--t = DIGIT_PAIRS[pair + 1];
+        *--t = DIGIT_PAIRS[pair];
+    }
+    else {
+        *--t = (char) ('0' + value);
+    }
+
+    size_t length = tmp + sizeof(tmp) - t;
+    memcpy(p, t, length);
+    return p + length;
+}
+
+char* formatFixed(char* p, double value, int precision)
+{
+    if (value != value) return p;
+
+    if (precision < 0) precision = 0;
+    if (precision > MAX_PRECISION) precision = MAX_PRECISION;
+
+    if (value < 0) {
+        *p++ = '-';
+        value = -value;
+    }
+
+    // rint() rounds halves to even like printf does
+    double scaled = rint(value * POW10[precision]);
+    if (!(scaled < MAX_EXACT)) {
+        int n = snprintf(p, RowFormatter::MAX_FIELD_WIDTH - 1, "%.*g", 17, value);
+        return p + ((n < 0) ? 0 : n);
+    }
+
+    uint64_t v = (uint64_t) scaled;
+    p = formatInteger(p, v / POW10[precision]);
+    if (precision == 0) return p;
+
+    *p++ = '.';
+    uint64_t fraction = v % POW10[precision];
+    for (int i = precision - 1; i >= 0; i--) {
+        p[i] = (char) ('0' + fraction % 10);
+        fraction /= 10;
+    }
+    return p + precision;
+}
+
+void RowFormatter::clear()
+{
+    m_columns.clear();
+    m_buffer.clear();
+}
+
+void RowFormatter::addColumn(const double* data, int rate, int precision)
+{
+    Column column = { data, rate, precision };
+    m_columns.push_back(column);
+}
+
+void RowFormatter::compile()
+{
+    // "_" plus a separator and the widest value for every column
+    m_buffer.resize(1 + m_columns.size() * (MAX_FIELD_WIDTH + 1));
+}
+
+const char* RowFormatter::format(int ts, int prevTs, size_t& length)
+{
+    char* start = &m_buffer[0];
+    char* p = start;
+    *p++ = '_';
+
+    vector< Column >::const_iterator iter = m_columns.begin();
+    for ( ; iter != m_columns.end(); ++iter) {
+        *p++ = ',';
+        if (ts / iter->m_rate == prevTs / iter->m_rate) continue;
+        p = formatFixed(p, *iter->m_data, iter->m_precision);
+    }
+
+    length = p - start;
+    return start;
+}
+
+} // namespace lincore
@@ -0,0 +1,69 @@
+/**********************************************
+   File:   row_formatter.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef ROW_FORMATTER_H
+#define ROW_FORMATTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+using std::vector;
+
+namespace lincore {
+
+// Write a number without a terminating zero, return the end of it.
+// NaN writes nothing, which leaves the field empty.
+char* formatInteger(char* p, uint64_t value);
+char* formatFixed(char* p, double value, int precision);
+
+/************************************
+ * Stream row serializer. The columns are compiled once, every
+ * row is written into the same preallocated buffer.
+ ************************************/
+class RowFormatter
+{
+public:
+    // Longest text formatFixed() produces
+    static const size_t MAX_FIELD_WIDTH = 32;
+
+public:
+    void clear();
+    void addColumn(const double* data, int rate, int precision);
+    void compile();
+
+    // Columns whose rate boundary lies in (prevTs, ts] get a value.
+    // The row is valid until the next call.
+    const char* format(int ts, int prevTs, size_t& length);
+
+private:
+    struct Column
+    {
+        const double* m_data;
+        int m_rate;
+        int m_precision;
+    };
+
+private:
+    vector< Column > m_columns;
+    vector< char > m_buffer;
+};
+
+} // namespace lincore
+
+#endif // ROW_FORMATTER_H
@@ -0,0 +1,81 @@
+/**********************************************
+   File:   row_ring.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "row_ring.h"
+#include "utils/futex.h"
+
+using namespace cdb;
+
+namespace lincore {
+
+void RowRing::init(size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    if (size < 2) size = 2;
+
+    m_rows.resize(size);
+    m_mask = size - 1;
+}
+
+bool RowRing::push(int ts, const char* data, size_t length, RowKind kind)
+{
+    size_t head = m_head;
+    size_t tail = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+    if (head - tail > m_mask) return false;
+
+    Row& row = m_rows[head & m_mask];
+    row.m_ts = ts;
+    row.m_kind = kind;
+    row.m_data.assign(data, length);
+
+    __atomic_store_n(&m_head, head + 1, __ATOMIC_RELEASE);
+    wake();
+    return true;
+}
+
+bool RowRing::pop(Row& row)
+{
+    size_t tail = m_tail;
+    size_t head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+    if (tail == head) return false;
+
+    Row& slot = m_rows[tail & m_mask];
+    row.m_ts = slot.m_ts;
+    row.m_kind = slot.m_kind;
+    row.m_data.swap(slot.m_data);
+
+    __atomic_store_n(&m_tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void RowRing::wait(int timeoutMs)
+{
+    // A push after the signal was sampled changes it and fails the wait
+    int signal = __atomic_load_n(&m_signal, __ATOMIC_ACQUIRE);
+    if (m_tail != __atomic_load_n(&m_head, __ATOMIC_ACQUIRE)) return;
+    Futex::wait(&m_signal, signal, timeoutMs);
+}
+
+void RowRing::wake()
+{
+    __atomic_add_fetch(&m_signal, 1, __ATOMIC_RELEASE);
+    Futex::wake(&m_signal);
+}
+
+} // namespace lincore
@@ -0,0 +1,78 @@
+/**********************************************
+   File:   row_ring.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef ROW_RING_H
+#define ROW_RING_H
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace lincore {
+
+#define CACHE_LINE_SIZE 64
+
+enum RowKind
+{
+    ROW_DATA,
+    ROW_SCHEMA      // m_data is the stream title of the rows after it
+};
+
+struct Row
+{
+    Row() : m_ts(0), m_kind(ROW_DATA) {}
+    int m_ts;
+    RowKind m_kind;
+    string m_data;
+};
+
+/************************************
+ * Bounded single producer / single consumer ring of serialized rows.
+ * Slots are reused, so once every slot has grown to the row size
+ * push and pop do not allocate.
+ ************************************/
+class RowRing
+{
+public:
+    RowRing() : m_head(0), m_tail(0), m_signal(0), m_mask(0) {}
+
+    void init(size_t capacity);
+
+    // Producer side, returns false if the ring is full
+    bool push(int ts, const char* data, size_t length, RowKind kind = ROW_DATA);
+
+    // Consumer side, swaps the oldest row into the argument
+    bool pop(Row& row);
+    void wait(int timeoutMs);
+
+    void wake();
+    size_t capacity() { return m_rows.size(); }
+
+private:
+    size_t m_head __attribute__((aligned(CACHE_LINE_SIZE)));
+    size_t m_tail __attribute__((aligned(CACHE_LINE_SIZE)));
+    int m_signal __attribute__((aligned(CACHE_LINE_SIZE)));
+    size_t m_mask;
+    vector< Row > m_rows;
+};
+
+} // namespace lincore
+
+#endif // ROW_RING_H
@@ -0,0 +1,336 @@
+/**********************************************
+   File:   sender.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "sender.h"
+#include "utils/config.h"
+#include "utils/exception.h"
+#include "utils/log.h"
+#include "utils/perf.h"
+#include <algorithm>
+#include <time.h>
+#include <unistd.h>
+
+using namespace cdb;
+
+namespace lincore {
+
+static const int DEFAULT_RING_SIZE = 64;
+static const int WAIT_TIMEOUT_MS = 1000;
+static const int REPLAY_BATCH = 1024;
+static const int MIN_BACKOFF_MS = 1000;
+static const int MAX_BACKOFF_MS = 60000;
+static const int PAUSE_SLICE_MS = 100;
+
+Sender::~Sender()
+{
+    stop();
+}
+
+void Sender::init()
+{
+    m_client.init();
+
+    int ringSize = DEFAULT_RING_SIZE;
+    Config::instance().get("ring_size", ringSize);
+    if (ringSize <= 0) THROW("Invalid ring_size");
+    m_ring.init(ringSize);
+
+    m_spool.init();
+
+    m_droppedCounter = Perf::instance().counter("lincore.rows_dropped");
+}
+
+void Sender::setSchema(const list< MetricInfo >& info, const string& staticData, const string& header)
+{
+    m_info = info;
+    m_staticData = staticData;
+    m_header = header;
+}
+
+void Sender::start()
+{
+    if (m_thread != 0) return;
+    __atomic_store_n(&m_keepGoing, true, __ATOMIC_RELEASE);
+    m_thread = new boost::thread(&Sender::run, this);
+}
+
+void Sender::stop()
+{
+    if (m_thread == 0) return;
+    __atomic_store_n(&m_keepGoing, false, __ATOMIC_RELEASE);
+    m_ring.wake();
+    m_thread->join();
+    delete m_thread;
+    m_thread = 0;
+}
+
+void Sender::post(int ts, const char* row, size_t length)
+{
+    // A row must not overtake the schema it was collected for
+    if ((!m_schemaPending || pushSchema()) && m_ring.push(ts, row, length)) return;
+
+    Perf::instance().inc(m_droppedCounter, 1);
+    LOG_WARN << "Send ring is full, dropped row " << ts;
+}
+
+void Sender::updateSchema(const list< MetricInfo >& added, const string& header)
+{
+    {
+        boost::mutex::scoped_lock lock(m_addedLock);
+        m_added.insert(m_added.end(), added.begin(), added.end());
+    }
+
+    // Only the latest title matters if the previous one is still waiting
+    m_pendingHeader = header;
+    m_schemaPending = true;
+    pushSchema();
+}
+
+bool Sender::pushSchema()
+{
+    if (!m_ring.push(0, m_pendingHeader.data(), m_pendingHeader.length(), ROW_SCHEMA)) return false;
+    m_schemaPending = false;
+    return true;
+}
+
+void Sender::run()
+{
+    // The thread outlives any error, rows keep piling up in the ring
+    // while it backs off and only overflow is dropped
+    int backoff = 0;
+    while (__atomic_load_n(&m_keepGoing, __ATOMIC_ACQUIRE)) {
+        try {
+            step();
+            backoff = 0;
+            continue;
+        }
+        catch(Exception& e) {
+            LOG_ERROR << "Sender failed: " << e.cause();
+        }
+        catch(...) {
+            LOG_ERROR << "Sender failed on unidentified exception";
+        }
+
+        recover();
+        backoff = (backoff == 0) ? MIN_BACKOFF_MS : std::min(backoff * 2, MAX_BACKOFF_MS);
+        pause(backoff);
+    }
+}
+
+void Sender::step()
+{
+    if (!m_streaming) startStreaming();
+
+    if (!m_streaming || !m_spool.pending()) m_ring.wait(WAIT_TIMEOUT_MS);
+
+    // Live rows queue up behind spooled ones to keep the time order
+    while (m_ring.pop(m_row)) {
+        if (m_row.m_kind == ROW_SCHEMA) changeSchema(m_row);
+        else if (m_streaming && !m_spool.pending()) send(m_row);
+        else keep(m_row);
+    }
+    flush();
+
+    if (m_streaming && m_spool.pending()) replay();
+}
+
+void Sender::recover()
+{
+    // The stream is in an unknown state, start it over. The batch is
+    // not spooled, the spool may be what failed.
+    m_streaming = false;
+    m_spool.rewind();
+    for (size_t i=0; i < m_batchSize; i++) drop("sender failure");
+    m_batchSize = 0;
+}
+
+void Sender::pause(int ms)
+{
+    for (int left = ms; (left > 0) && __atomic_load_n(&m_keepGoing, __ATOMIC_ACQUIRE); left -= PAUSE_SLICE_MS) {
+        usleep(PAUSE_SLICE_MS * 1000);
+    }
+}
+
+void Sender::startStreaming()
+{
+    time_t now = time(NULL);
+    if (now == m_lastAttempt) return;
+    m_lastAttempt = now;
+
+    LOG_INFO << "Connecting to " << m_client.host() << ":" << m_client.port();
+    try {
+        m_client.createSchema(m_info);
+        if (!m_staticData.empty()) {
+            m_client.setStaticData(m_staticData);
+        }
+        m_client.startStreaming(m_header);
+        m_client.flush();
+    }
+    catch(Exception&) {
+        if (m_spool.enabled()) {
+            LOG_WARN << "Rows are spooled until the connection is restored";
+        }
+        else {
+            LOG_WARN << "Rows are dropped until the connection is restored";
+        }
+        return;
+    }
+    m_streaming = true;
+    m_streamHeader = m_header;
+
+    if (m_spool.pending()) {
+        LOG_INFO << "Replaying spooled rows";
+    }
+}
+
+void Sender::changeSchema(const Row& row)
+{
+    // Rows collected so far go out under the old header
+    flush();
+
+    list< MetricInfo > added;
+    {
+        boost::mutex::scoped_lock lock(m_addedLock);
+        added.swap(m_added);
+    }
+    m_info.insert(m_info.end(), added.begin(), added.end());
+    m_header = row.m_data;
+    LOG_INFO << "Stream schema changed, " << added.size() << " metrics added";
+
+    // Otherwise the next connect creates the whole schema and spooled
+    // rows pick the header up from their own records
+    if (!m_streaming) return;
+
+    try {
+        // Spooled rows may reach the new header before the live ones
+        m_client.createMetrics(added);
+        if (!m_spool.pending()) {
+            m_client.startStreaming(m_header);
+            m_streamHeader = m_header;
+        }
+        m_client.flush();
+    }
+    catch(Exception&) {
+        failed();
+    }
+}
+
+void Sender::send(Row& row)
+{
+    if (m_batchSize == m_batch.size()) m_batch.resize(m_batchSize + 1);
+    Row& kept = m_batch[m_batchSize++];
+    kept.m_ts = row.m_ts;
+    kept.m_data.swap(row.m_data);
+
+    // The server stamps "_" with its own clock, rows that waited
+    // in the ring carry the tick they were collected at instead
+    const string* line = &kept.m_data;
+    if (kept.m_ts < time(NULL) - 1) {
+        line = &stamp(kept.m_ts, kept.m_data.data(), kept.m_data.length());
+    }
+
+    try {
+        // Rows already written must not be spooled again on a later failure
+        if (m_client.send(*line)) m_batchSize = 0;
+    }
+    catch(Exception&) {
+        failed();
+    }
+}
+
+void Sender::flush()
+{
+    if (!m_streaming) return;
+
+    bool wrote = (m_batchSize != 0);
+    try {
+        m_client.flush();
+    }
+    catch(Exception&) {
+        failed();
+        return;
+    }
+    m_batchSize = 0;
+
+    // Live rows getting through confirm the last replayed ones
+    if (wrote) m_spool.commit();
+}
+
+void Sender::failed()
+{
+    m_streaming = false;
+    // Replayed rows not confirmed yet go out again after the reconnect
+    m_spool.rewind();
+    for (size_t i=0; i < m_batchSize; i++) keep(m_batch[i]);
+    m_batchSize = 0;
+}
+
+void Sender::replay()
+{
+    SpoolRecord record;
+    try {
+        for (int n=0; (n < REPLAY_BATCH) && m_spool.next(record); n++) {
+            if (record.m_type == SPOOL_HEADER) {
+                m_line.assign(record.m_data, record.m_length);
+                if (m_line != m_streamHeader) {
+                    m_client.startStreaming(m_line);
+                    m_streamHeader = m_line;
+                }
+                continue;
+            }
+            m_client.send(stamp(record.m_ts, record.m_data, record.m_length));
+        }
+        m_client.flush();
+
+        if (!m_spool.pending() && (m_streamHeader != m_header)) {
+            m_client.startStreaming(m_header);
+            m_client.flush();
+            m_streamHeader = m_header;
+        }
+    }
+    catch(Exception&) {
+        m_streaming = false;
+        m_spool.rewind();
+        return;
+    }
+
+    m_spool.commit();
+}
+
+void Sender::keep(const Row& row)
+{
+    if (m_spool.enabled()) m_spool.append(row.m_ts, row.m_data, m_header);
+    else drop("not connected");
+}
+
+const string& Sender::stamp(int ts, const char* data, size_t length)
+{
+    char buf[RowFormatter::MAX_FIELD_WIDTH];
+    m_line.assign(buf, formatInteger(buf, ts) - buf);
+    if ((length > 0) && (data[0] == '_')) m_line.append(data + 1, length - 1);
+    else m_line.append(data, length);
+    return m_line;
+}
+
+void Sender::drop(const char* reason)
+{
+    Perf::instance().inc(m_droppedCounter, 1);
+    LOG_DEBUG << "Dropped row: " << reason;
+}
+
+} // namespace lincore
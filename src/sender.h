@@ -0,0 +1,114 @@
+/**********************************************
+   File:   sender.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef SENDER_H
+#define SENDER_H
+
+#include "client.h"
+#include "row_ring.h"
+#include "spool.h"
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <string>
+#include <list>
+
+using std::string;
+using std::list;
+
+namespace lincore {
+
+/************************************
+ * Owns the ClockWorkDB connection on a thread of its own.
+ * The collector posts serialized rows, the sender thread takes
+ * them off the ring and reconnects as needed, so a slow or
+ * broken socket never delays sampling. While the server is
+ * unreachable rows go to the spool and are replayed, oldest
+ * first, before any live row once the connection is back.
+ * A schema change travels through the ring as a row of its own,
+ * so every row is sent under the header it was collected for.
+ * An unexpected error drops the connection and the rows of the
+ * current batch, the thread backs off and starts over.
+ ************************************/
+class Sender
+{
+public:
+    Sender() : m_streaming(false), m_keepGoing(true), m_lastAttempt(0),
+               m_thread(0), m_droppedCounter(0), m_schemaPending(false),
+               m_batchSize(0) {}
+    ~Sender();
+
+    void init();
+    void setSchema(const list< MetricInfo >& info, const string& staticData, const string& header);
+
+    void start();
+    void stop();
+
+    // Collector side: rows that do not fit into the ring are dropped
+    void post(int ts, const char* row, size_t length);
+    // Collector side: metrics added to the stream and its new title,
+    // rows posted afterwards follow the new header
+    void updateSchema(const list< MetricInfo >& added, const string& header);
+
+private:
+    Client m_client;
+    RowRing m_ring;
+    Spool m_spool;
+    bool m_streaming;
+    bool m_keepGoing;
+    time_t m_lastAttempt;
+    boost::thread* m_thread;
+    long* m_droppedCounter;
+
+    // Collector side: a schema row waiting for room in the ring
+    bool m_schemaPending;
+    string m_pendingHeader;
+    // Metrics not created on the server yet
+    boost::mutex m_addedLock;
+    list< MetricInfo > m_added;
+
+    list< MetricInfo > m_info;
+    string m_staticData;
+    string m_header;
+    string m_streamHeader;
+    string m_line;
+
+    // Rows written to the client but not flushed yet
+    vector< Row > m_batch;
+    size_t m_batchSize;
+    Row m_row;
+
+private:
+    void run();
+    void step();
+    void recover();
+    void pause(int ms);
+    void startStreaming();
+    bool pushSchema();
+    void changeSchema(const Row& row);
+    void send(Row& row);
+    void flush();
+    void failed();
+    void replay();
+    void keep(const Row& row);
+    void drop(const char* reason);
+    const string& stamp(int ts, const char* data, size_t length);
+};
+
+} // namespace lincore
+
+#endif // SENDER_H
@@ -17,13 +17,13 @@
  **********************************************/
 
 #include "sigar_iface.h"
+#include "proc_parse.h"
 #include "sigar/sigar.h"
 #include "sigar/sigar_format.h"
 #include <sys/statvfs.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
-#include <string.h>
 
 namespace lincore {
     
@@ -92,6 +92,11 @@ void SigarIface::uninit()
 
 void SigarIface::getLoadAverages(LoadAverages& systemLoad)
 {
+    if (m_native) {
+        m_proc.getLoadAverages(systemLoad);
+        return;
+    }
+
     SIGAR_DECL(sigar);
     SIGAR_GET(sigar_loadavg_t,sigar_loadavg_get,"load averages");
     systemLoad._1min = data.loadavg[0];
@@ -101,6 +106,11 @@ void SigarIface::getLoadAverages(LoadAverages& systemLoad)
 
 void SigarIface::getMemory(Memory& memory)
 {
+    if (m_native) {
+        m_proc.getMemory(memory);
+        return;
+    }
+
     SIGAR_DECL(sigar);
     SIGAR_GET(sigar_mem_t,sigar_mem_get,"memory");
     memory.total = data.total;
@@ -120,6 +130,11 @@ void SigarIface::getMemory(Memory& memory)
 
 void SigarIface::getSwap(Swap& swap)
 {
+    if (m_native) {
+        m_proc.getSwap(swap);
+        return;
+    }
+
     SIGAR_DECL(sigar);
     SIGAR_GET(sigar_swap_t,sigar_swap_get,"swap");
     swap.total = data.total / 1024;
@@ -129,20 +144,13 @@ void SigarIface::getSwap(Swap& swap)
     swap.page_out = data.page_out;
 }
 
-void SigarIface::getSwapMetricsDiff(const Swap& prev, const Swap& curr, Swap& nm)
-{
-#define NM_DIFF(f)  nm.f = (curr.f <= prev.f) ? 0 : curr.f - prev.f;
-    NM_DIFF(page_in);
-    NM_DIFF(page_out);
-#undef NM_DIFF
-
-    nm.total = curr.total;
-    nm.used = curr.used;
-    nm.free = curr.free;
-}
-
 void SigarIface::getCPU(CPU& cpu)
 {
+    if (m_native) {
+        m_proc.getCPU(cpu);
+        return;
+    }
+
     SIGAR_DECL(sigar);
     SIGAR_GET(sigar_cpu_t,sigar_cpu_get,"cpu");
     cpu.user = data.user;
@@ -156,10 +164,29 @@ void SigarIface::getCPU(CPU& cpu)
     cpu.total = data.total;
 }
 
+void SigarIface::getPerCPU(double* table, size_t cpus)
+{
+    if (!m_native) {
+        fprintf(stderr, "Per CPU times need the native backend\n");
+        throw -1;
+    }
+    m_proc.getPerCPU(table, cpus);
+}
+
+void SigarIface::getSchedStat(double* table, size_t cpus)
+{
+    if (!m_native) {
+        fprintf(stderr, "Scheduler statistics need the native backend\n");
+        throw -1;
+    }
+    m_proc.getSchedStat(table, cpus);
+}
+
 void SigarIface::getCPUPercent(const CPU& prev, const CPU& curr, CPUPercent& perc)
 {
     double diff_user, diff_sys, diff_nice, diff_idle;
     double diff_wait, diff_irq, diff_soft_irq, diff_stolen;
+    double diff_guest, diff_guest_nice;
     double diff_total;
 
     diff_user = curr.user - prev.user;
@@ -170,6 +197,8 @@ void SigarIface::getCPUPercent(const CPU& prev, const CPU& curr, CPUPercent& per
     diff_irq = curr.irq - prev.irq;
     diff_soft_irq = curr.softIrq - prev.softIrq;
     diff_stolen = curr.stolen - prev.stolen;
+    diff_guest = curr.guest - prev.guest;
+    diff_guest_nice = curr.guestNice - prev.guestNice;
 
     diff_user = diff_user < 0 ? 0 : diff_user;
     diff_sys  = diff_sys  < 0 ? 0 : diff_sys;
@@ -179,6 +208,8 @@ void SigarIface::getCPUPercent(const CPU& prev, const CPU& curr, CPUPercent& per
     diff_irq = diff_irq < 0 ? 0 : diff_irq;
     diff_soft_irq = diff_soft_irq < 0 ? 0 : diff_soft_irq;
     diff_stolen = diff_stolen < 0 ? 0 : diff_stolen;
+    diff_guest = diff_guest < 0 ? 0 : diff_guest;
+    diff_guest_nice = diff_guest_nice < 0 ? 0 : diff_guest_nice;
 
     diff_total =
         diff_user + diff_sys + diff_nice + diff_idle +
@@ -193,6 +224,8 @@ void SigarIface::getCPUPercent(const CPU& prev, const CPU& curr, CPUPercent& per
     perc.irq = diff_irq / diff_total * 100;
     perc.softIrq = diff_soft_irq / diff_total * 100;
     perc.stolen = diff_stolen / diff_total * 100;
+    perc.guest = diff_guest / diff_total * 100;
+    perc.guestNice = diff_guest_nice / diff_total * 100;
 
     perc.combined =
         perc.user + perc.sys + perc.nice + perc.wait;
@@ -201,12 +234,36 @@ void SigarIface::getCPUPercent(const CPU& prev, const CPU& curr, CPUPercent& per
 
 void SigarIface::getProcessCount(ProcessCount& processCount)
 {
+    if (m_native) {
+        m_proc.getProcessCount(processCount);
+        return;
+    }
+
     SIGAR_DECL(sigar);
     SIGAR_GET(sigar_proc_stat_t,sigar_proc_stat_get,"process count");
     processCount.total = data.total;
     processCount.threads = data.threads;
 }
 
+void SigarIface::getProcessStates(ProcessStates& states)
+{
+    if (!m_native) {
+        fprintf(stderr, "Process states need the native backend\n");
+        throw -1;
+    }
+    m_proc.getProcessStates(states);
+}
+
+static bool matched(const ProcessIDs& procs, int id)
+{
+    for (size_t i=0; i < procs.size(); i++) {
+        if (procs[i].id == id) return true;
+    }
+    return false;
+}
+
+// The first process matching a filter, one per filter. The
+// arguments are read once per process, not once per filter.
 static void matchProcesses(sigar_t* sigar, 
                             ProcessFilters& filters, 
                             sigar_proc_list_t& data, 
@@ -221,11 +278,16 @@ static void matchProcesses(sigar_t* sigar,
         res = sigar_proc_state_get(sigar, data.data[i], &procState);
         if (res != SIGAR_OK) continue;
 
+        bool loaded = false;
         for (iter=filters.begin(); iter != filters.end(); iter++) {
             if (strcmp(procState.name, iter->exec.c_str()) != 0) continue;
+            if (matched(procs, iter->id)) continue;
 
-            res = sigar_proc_args_get(sigar, data.data[i], &procArgs);
-            if (res != SIGAR_OK) continue;
+            if (!loaded) {
+                res = sigar_proc_args_get(sigar, data.data[i], &procArgs);
+                if (res != SIGAR_OK) break;
+                loaded = true;
+            }
 
             for (unsigned long j=0; j < procArgs.number; j++) {
                 if (strstr(procArgs.data[j], iter->args.c_str()) == 0) continue;
@@ -234,9 +296,9 @@ static void matchProcesses(sigar_t* sigar,
                 procs.push_back(processID);
                 break;
             }
-
-            sigar_proc_args_destroy(sigar, &procArgs);
         }
+
+        if (loaded) sigar_proc_args_destroy(sigar, &procArgs);
     }
 }
 
@@ -304,42 +366,36 @@ void SigarIface::getFileSystems(int type, FileSystems& fs)
     sigar_file_system_list_destroy(sigar, &data);
 }
 
-void SigarIface::getDisk(const std::string& diskName, Disk& disk)
+int SigarIface::findDisk(const std::string& diskName)
 {
-    /********************************************
-    SIGAR_DECL(sigar);
-    const char* name = diskName.c_str();
-    SIGAR_GET_BY_NAME(sigar_disk_usage_t,sigar_disk_usage_get,"disk usage");
-
-    disk.reads = data.reads;
-    disk.writes = data.writes;
-    disk.writeBytes = data.write_bytes;
-    disk.readBytes = data.read_bytes;
-    disk.readTime = data.rtime;
-    disk.writeTime = data.wtime;
-    disk.waitTime = data.wtime;
-    disk.queueTime = data.qtime;
-    disk.totalTime = data.time;
-    disk.snapTime = data.snaptime;
-    disk.serviceTime = data.service_time;
-    disk.queue = data.queue;
-     *********************************************/
-
-    size_t n = 0;
-    for ( ; n < m_diskStats.size(); n++) {
-        if (diskName == m_diskStats[n].m_name) break;
+    for (size_t n = 0; n < m_diskStats.size(); n++) {
+        if (diskName == m_diskStats[n].m_name) return (int) n;
     }
-    if (n == m_diskStats.size()) return;
-
-    disk.reads = m_diskStats[n].m_reads;
-    disk.writes = m_diskStats[n].m_writes;
-    disk.readBytes = m_diskStats[n].m_sectorsRead * SECTOR_SIZE;
-    disk.writeBytes = m_diskStats[n].m_sectorsWritten * SECTOR_SIZE;
-    disk.readTime = m_diskStats[n].m_millisecRead;
-    disk.writeTime = m_diskStats[n].m_millisecWrite;
-    disk.totalTime = m_diskStats[n].m_millisecIO;
+    return -1;
+}
+
+static void fillDisk(const DiskStats& ds, Disk& disk)
+{
+    disk.reads = ds.m_reads;
+    disk.writes = ds.m_writes;
+    disk.readBytes = ds.m_sectorsRead * SECTOR_SIZE;
+    disk.writeBytes = ds.m_sectorsWritten * SECTOR_SIZE;
+    disk.readTime = ds.m_millisecRead;
+    disk.writeTime = ds.m_millisecWrite;
+    disk.totalTime = ds.m_millisecIO;
     disk.waitTime = disk.totalTime - (disk.readTime + disk.writeTime);
-    disk.queue = m_diskStats[n].m_queue;
+    disk.queue = ds.m_queue;
+    disk.discards = ds.m_discards;
+    disk.discardBytes = ds.m_sectorsDiscarded * SECTOR_SIZE;
+    disk.discardTime = ds.m_millisecDiscard;
+    disk.flushes = ds.m_flushes;
+    disk.flushTime = ds.m_millisecFlush;
+}
+
+void SigarIface::getDisk(int index, Disk& disk)
+{
+    if ((index < 0) || ((size_t) index >= m_diskStats.size())) return;
+    fillDisk(m_diskStats[index], disk);
 }
 
 void SigarIface::getDisk(Disk& disk)
@@ -353,82 +409,99 @@ void SigarIface::getDisk(Disk& disk)
         disk.writeTime += m_diskStats[n].m_millisecWrite;
         disk.totalTime += m_diskStats[n].m_millisecIO;
         disk.queue += m_diskStats[n].m_queue;
+        disk.discards += m_diskStats[n].m_discards;
+        disk.discardBytes += m_diskStats[n].m_sectorsDiscarded * SECTOR_SIZE;
+        disk.discardTime += m_diskStats[n].m_millisecDiscard;
+        disk.flushes += m_diskStats[n].m_flushes;
+        disk.flushTime += m_diskStats[n].m_millisecFlush;
     }
     disk.waitTime = disk.totalTime - (disk.readTime + disk.writeTime);
 }
 
 void SigarIface::readDisksStats()
 {
-    m_diskStats.clear();
-
-    char buf[512];
-    FILE* f = fopen("/proc/diskstats", "r");
-    while (!feof(f)) {
-        char* s = fgets(buf, sizeof(buf), f);
-        if (s == NULL) break;
+    if (!m_diskStatsFile.read()) {
+        fprintf(stderr, "Failed to read diststats: %s\n", strerror(errno));
+        throw -1;
+    }
 
-        for ( ; *s; s++) {
-            if (!((*s == ' ') || ((*s >= '0') && (*s <= '9')))) break;
-        }
-        if (*s == '\0') {
+    // Parsed in place, names are terminated inside the buffer
+    size_t count = 0;
+    bool changed = false;
+    char* p = m_diskStatsFile.data();
+    while (*p) {
+        unsigned long major, minor;
+        p = parseNumber(skipBlanks(p), major);
+        p = parseNumber(skipBlanks(p), minor);
+        p = skipBlanks(p);
+
+        char* name = p;
+        for ( ; *p && (*p != ' ') && (*p != '\n'); p++);
+        if (p == name) {
             fprintf(stderr, "Failed to read diststats: disk name not found\n");
             throw -1;
         }
-    
-        char* t = s;
-        for ( ; *t && (*t != ' '); t++);
-        if (*t == '\0') {
+        if (*p != ' ') {
             fprintf(stderr, "Failed to read diststats: values not found\n");
             throw -1;
         }
+        *p++ = '\0';
+
+        unsigned long values[DISKSTATS_MAX_FIELDS] = { 0 };
+        int fields = 0;
+        for (;;) {
+            p = skipBlanks(p);
+            if (!isDigit(*p)) break;
+            if (fields < DISKSTATS_MAX_FIELDS)
+                p = parseNumber(p, values[fields++]);
+            else
+                for ( ; isDigit(*p); p++);
+        }
+        if ((*p != '\n') && (*p != '\0')) {
+            fprintf(stderr, "Failed to read diststats: values not parsed\n");
+            throw -1;
+        }
+        if (*p == '\n') p++;
 
-        *t = '\0';
-        t++;
-
-        if (strstr(s, "ram") || strstr(s, "loop")) continue;
-
-        DiskStats ds;
-        int ret = sscanf(t, "%lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu",
-                  &ds.m_reads ,
-                  &ds.m_readsMerged ,
-                  &ds.m_sectorsRead ,
-                  &ds.m_millisecRead ,
-                  &ds.m_writes ,
-                  &ds.m_writesMerged ,
-                  &ds.m_sectorsWritten ,
-                  &ds.m_millisecWrite ,
-                  &ds.m_queue ,
-                  &ds.m_millisecIO ,
-                  &ds.m_weightedTime);
-        if (ret != 11) {
+        if (fields < DISKSTATS_MIN_FIELDS) {
             fprintf(stderr, "Failed to read diststats: values not parsed\n");
             throw -1;
         }
 
-        strncpy(ds.m_name, s, sizeof(ds.m_name));
+        if (strstr(name, "ram") || strstr(name, "loop")) continue;
 
-        m_diskStats.push_back(ds);
-    }
+        if (count == m_diskStats.size()) m_diskStats.push_back(DiskStats());
+        DiskStats& ds = m_diskStats[count++];
+        if (strncmp(ds.m_name, name, sizeof(ds.m_name) - 1) != 0) {
+            strncpy(ds.m_name, name, sizeof(ds.m_name) - 1);
+            ds.m_name[sizeof(ds.m_name) - 1] = '\0';
+            changed = true;
+        }
 
-}
+        ds.m_reads = values[0];
+        ds.m_readsMerged = values[1];
+        ds.m_sectorsRead = values[2];
+        ds.m_millisecRead = values[3];
+        ds.m_writes = values[4];
+        ds.m_writesMerged = values[5];
+        ds.m_sectorsWritten = values[6];
+        ds.m_millisecWrite = values[7];
+        ds.m_queue = values[8];
+        ds.m_millisecIO = values[9];
+        ds.m_weightedTime = values[10];
+        ds.m_discards = values[11];
+        ds.m_discardsMerged = values[12];
+        ds.m_sectorsDiscarded = values[13];
+        ds.m_millisecDiscard = values[14];
+        ds.m_flushes = values[15];
+        ds.m_millisecFlush = values[16];
+    }
 
-void SigarIface::getDiskMetricsDiff(const Disk& prev, const Disk& curr, Disk& nm)
-{
-#define NM_DIFF(f)  nm.f = (curr.f <= prev.f) ? 0 : curr.f - prev.f;
-    NM_DIFF(reads);
-    NM_DIFF(writes);
-    NM_DIFF(readBytes);
-    NM_DIFF(writeBytes);
-    NM_DIFF(readTime);
-    NM_DIFF(writeTime);
-    NM_DIFF(waitTime);
-    NM_DIFF(queueTime);
-    NM_DIFF(totalTime);
-    NM_DIFF(snapTime);
-    NM_DIFF(serviceTime);
-#undef NM_DIFF
-
-    nm.queue = curr.queue;
+    if (count != m_diskStats.size()) {
+        m_diskStats.resize(count);
+        changed = true;
+    }
+    if (changed) m_diskGeneration++;
 }
 
 void SigarIface::getFS(const std::string& dirName, FSInfo& fsInfo)
@@ -492,23 +565,6 @@ void SigarIface::getNet(const std::string& netName, NetMetrics& nm)
     nm.txOverruns = data.tx_overruns;
 }
 
-void SigarIface::getNetMetricsDiff(const NetMetrics& prev, const NetMetrics& curr, NetMetrics& nm)
-{
-#define NM_DIFF(f)  nm.f = (curr.f <= prev.f) ? 0 : curr.f - prev.f;
-    NM_DIFF(rxPackets);
-    NM_DIFF(rxBytes);
-    NM_DIFF(rxErrors);
-    NM_DIFF(rxDropped);
-    NM_DIFF(rxOverruns);
-
-    NM_DIFF(txPackets);
-    NM_DIFF(txBytes);
-    NM_DIFF(txErrors);
-    NM_DIFF(txDropped);
-    NM_DIFF(txOverruns);
-#undef NM_DIFF
-}
-
 void SigarIface::getCpuCores(int& cores)
 {
     cores = 0;
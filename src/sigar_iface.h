@@ -19,6 +19,8 @@
 #ifndef _SIGAR_IFACE_H_
 #define _SIGAR_IFACE_H_
 
+#include "proc_reader.h"
+#include "proc_backend.h"
 #include <vector>
 #include <list>
 #include <string>
@@ -39,7 +41,8 @@ struct LoadAverages
 struct Memory
 {
     Memory() : total(0), used(0), free(0), actualUsed(0), 
-               actualFree(0), percentUsed(0.0), percentFree(0.0) {}
+               actualFree(0), percentUsed(0.0), percentFree(0.0),
+               available(0), dirty(0), writeback(0) {}
     double total;
     double used;
     double free;
@@ -47,6 +50,11 @@ struct Memory
     double actualFree;
     double percentUsed;
     double percentFree;
+
+    // Native backend only
+    double available;
+    double dirty;
+    double writeback;
 };
 
 struct Swap
@@ -62,7 +70,7 @@ struct Swap
 struct CPU
 {
     CPU() : user(0), sys(0), nice(0), idle(0), wait(0), irq(0), softIrq(0),
-            stolen(0), total(0) {}
+            stolen(0), total(0), guest(0), guestNice(0) {}
     double user;
     double sys;
     double nice;
@@ -72,12 +80,16 @@ struct CPU
     double softIrq;
     double stolen;
     double total;
+
+    // Native backend only, included in user and nice
+    double guest;
+    double guestNice;
 };
 
 struct CPUPercent
 {
     CPUPercent() : user(0.0), sys(0.0), nice(0.0), idle(0.0), wait(0.0), irq(0.0), 
-                  softIrq(0.0), stolen(0.0), combined(0.0) {}
+                  softIrq(0.0), stolen(0.0), combined(0.0), guest(0.0), guestNice(0.0) {}
     double user;
     double sys;
     double nice;
@@ -87,13 +99,30 @@ struct CPUPercent
     double softIrq;
     double stolen;
     double combined;
+    double guest;
+    double guestNice;
 };
 
 struct ProcessCount
 {
-    ProcessCount() : total(0), threads(0) {}
+    ProcessCount() : total(0), threads(0), running(0), blocked(0) {}
     double total;
     double threads;
+    double running;     // runnable tasks, native backend only
+    double blocked;     // tasks waiting for I/O, native backend only
+};
+
+// Processes by the state in /proc/<pid>/stat
+struct ProcessStates
+{
+    ProcessStates() : running(0), sleeping(0), diskSleep(0), zombie(0),
+                      stopped(0), idle(0) {}
+    double running;
+    double sleeping;
+    double diskSleep;
+    double zombie;
+    double stopped;
+    double idle;
 };
 
 struct ProcessFilter
@@ -137,8 +166,14 @@ struct FileSystem
 };
 typedef std::vector<FileSystem> FileSystems;
 
+// Columns after major, minor and name: 11 up to 4.17, 15 with
+// discards (4.18) and 17 with flushes (5.5)
+static const int DISKSTATS_MIN_FIELDS = 11;
+static const int DISKSTATS_MAX_FIELDS = 17;
+
 struct DiskStats
 {
+    DiskStats() { m_name[0] = '\0'; }
     char m_name[64];
     unsigned long m_reads;               // 1
     unsigned long m_readsMerged;         // 2
@@ -151,13 +186,20 @@ struct DiskStats
     unsigned long m_queue;               // 9
     unsigned long m_millisecIO;          // 10
     unsigned long m_weightedTime;        // 11
+    unsigned long m_discards;            // 12
+    unsigned long m_discardsMerged;      // 13
+    unsigned long m_sectorsDiscarded;    // 14
+    unsigned long m_millisecDiscard;     // 15
+    unsigned long m_flushes;             // 16
+    unsigned long m_millisecFlush;       // 17
 };
 
 struct Disk
 {
     Disk() : reads(0), writes(0), writeBytes(0), readBytes(0), readTime(0),
              writeTime(0), waitTime(0), queueTime(0), totalTime(0),
-             snapTime(0), serviceTime(0), queue(0) {}
+             snapTime(0), serviceTime(0), queue(0), discards(0),
+             discardBytes(0), discardTime(0), flushes(0), flushTime(0) {}
     double reads;
     double writes;
     double writeBytes;
@@ -170,6 +212,11 @@ struct Disk
     double snapTime;
     double serviceTime;
     double queue;
+    double discards;
+    double discardBytes;
+    double discardTime;
+    double flushes;
+    double flushTime;
 };
 
 struct FSInfo
@@ -221,34 +268,56 @@ struct Tcp
 class SigarIface
 {
 public:
-    SigarIface() :  m_handle(0) {}
+    SigarIface() :  m_diskStatsFile("/proc/diskstats"), m_diskGeneration(0),
+                    m_native(false), m_handle(0) {}
     void init();
     void uninit();
 
+    // CPU, memory, swap and load averages from procfs instead of sigar
+    void setNative(bool native) { m_native = native; }
+    bool native() { return m_native; }
+    // Start of a tick, procfs files are re-read on the next call
+    void nextTick() { m_proc.invalidate(); }
+
     void getLoadAverages(LoadAverages& systemLoad);
     void getMemory(Memory& memory);
     void getSwap(Swap& swap);
-    void getSwapMetricsDiff(const Swap& prev, const Swap& curr, Swap& nm);
     void getCPU(CPU& cpu);
     void getCPUPercent(const CPU& prev, const CPU& curr, CPUPercent& cpuPerc);
+    // Native backend only, see ProcBackend::getPerCPU()
+    void getPerCPU(double* table, size_t cpus);
+    // Native backend only, see ProcBackend::getSchedStat()
+    bool hasSchedStat() { return m_native && m_proc.hasSchedStat(); }
+    void getSchedStat(double* table, size_t cpus);
     void getProcessCount(ProcessCount& processCount);
+    // Native backend only, reads the stat file of every process
+    void getProcessStates(ProcessStates& states);
     void getProcessIDs(ProcessFilters& filters, ProcessIDs& procs);
     void getProcessTimes(int pid, ProcessTimes& processTimes);
     void getProcessMetrics(int pid, const ProcessTimes& pt, int lastTime, ProcessMetrics& pm);
     void getFileSystems(int type, FileSystems& fs);
     void readDisksStats();
-    void getDisk(const std::string& diskName, Disk& disk);
+    // Position of the disk in the last readDisksStats(), -1 if absent.
+    // Positions stay valid while diskGeneration() does not change.
+    int findDisk(const std::string& diskName);
+    unsigned int diskGeneration() { return m_diskGeneration; }
+    size_t diskCount() { return m_diskStats.size(); }
+    const char* diskName(int index) { return m_diskStats[index].m_name; }
+    void getDisk(int index, Disk& disk);
     void getDisk(Disk& disk);
-    void getDiskMetricsDiff(const Disk& prev, const Disk& curr, Disk& nm);
-    void getFS(const std::string& dirName, FSInfo& fsInfo);
+    // Touches no state, safe on a worker that may outlive the instance
+    static void getFS(const std::string& dirName, FSInfo& fsInfo);
     void getNetInfo(NetInfo& netInfo);
     void getNet(const std::string& netName, NetMetrics& nm);
-    void getNetMetricsDiff(const NetMetrics& prev, const NetMetrics& curr, NetMetrics& nm);
     void getCpuCores(int& cores);
     void getTcp(Tcp& tcp);
 
 private:
     std::vector< DiskStats > m_diskStats;
+    ProcReader m_diskStatsFile;
+    unsigned int m_diskGeneration;
+    ProcBackend m_proc;
+    bool m_native;
 
 private:
     void* m_handle;
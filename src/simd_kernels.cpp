@@ -0,0 +1,180 @@
+/**********************************************
+   File:   simd_kernels.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "simd_kernels.h"
+// The default i686 target has no SSE2, there only the scalar loops are built
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+namespace lincore {
+
+typedef void (*CounterDeltasFunc)(const double*, double*, double*, size_t);
+typedef void (*ColumnPercentsFunc)(const double*, size_t, size_t, double*, double*);
+
+static void counterDeltasScalar(const double* curr, double* prev, double* delta, size_t i, size_t count)
+{
+    for ( ; i < count; i++) {
+        // NaN on either side gives 0, as the max_pd of the vector loops does
+        delta[i] = !(curr[i] > prev[i]) ? 0 : curr[i] - prev[i];
+        prev[i] = curr[i];
+    }
+}
+
+#if defined(__SSE2__)
+static void counterDeltasSSE2(const double* curr, double* prev, double* delta, size_t count)
+{
+    const __m128d zero = _mm_setzero_pd();
+    size_t i = 0;
+    for ( ; i + 2 <= count; i += 2) {
+        __m128d c = _mm_loadu_pd(curr + i);
+        __m128d p = _mm_loadu_pd(prev + i);
+        _mm_storeu_pd(delta + i, _mm_max_pd(_mm_sub_pd(c, p), zero));
+        _mm_storeu_pd(prev + i, c);
+    }
+    counterDeltasScalar(curr, prev, delta, i, count);
+}
+
+__attribute__((target("avx2")))
+static void counterDeltasAVX2(const double* curr, double* prev, double* delta, size_t count)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    size_t i = 0;
+    for ( ; i + 4 <= count; i += 4) {
+        __m256d c = _mm256_loadu_pd(curr + i);
+        __m256d p = _mm256_loadu_pd(prev + i);
+        _mm256_storeu_pd(delta + i, _mm256_max_pd(_mm256_sub_pd(c, p), zero));
+        _mm256_storeu_pd(prev + i, c);
+    }
+    counterDeltasScalar(curr, prev, delta, i, count);
+}
+
+#endif // __SSE2__
+
+static void columnPercentsScalar(const double* table, size_t rows, size_t count,
+                                 double* total, double* percent, size_t i)
+{
+    for ( ; i < count; i++) {
+        double sum = 0;
+        for (size_t r=0; r < rows; r++) sum += table[r * count + i];
+        total[i] = sum;
+
+        double scale = (sum > 0) ? 100 / sum : 0;
+        for (size_t r=0; r < rows; r++) percent[r * count + i] = table[r * count + i] * scale;
+    }
+}
+
+#if defined(__SSE2__)
+static void columnPercentsSSE2(const double* table, size_t rows, size_t count, double* total, double* percent)
+{
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d hundred = _mm_set1_pd(100);
+    size_t i = 0;
+    for ( ; i + 2 <= count; i += 2) {
+        __m128d sum = zero;
+        for (size_t r=0; r < rows; r++) sum = _mm_add_pd(sum, _mm_loadu_pd(table + r * count + i));
+        _mm_storeu_pd(total + i, sum);
+
+        // 100 / 0 is masked off to 0
+        __m128d scale = _mm_and_pd(_mm_div_pd(hundred, sum), _mm_cmpgt_pd(sum, zero));
+        for (size_t r=0; r < rows; r++) {
+            size_t k = r * count + i;
+            _mm_storeu_pd(percent + k, _mm_mul_pd(_mm_loadu_pd(table + k), scale));
+        }
+    }
+    columnPercentsScalar(table, rows, count, total, percent, i);
+}
+
+__attribute__((target("avx2")))
+static void columnPercentsAVX2(const double* table, size_t rows, size_t count, double* total, double* percent)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d hundred = _mm256_set1_pd(100);
+    size_t i = 0;
+    for ( ; i + 4 <= count; i += 4) {
+        __m256d sum = zero;
+        for (size_t r=0; r < rows; r++) sum = _mm256_add_pd(sum, _mm256_loadu_pd(table + r * count + i));
+        _mm256_storeu_pd(total + i, sum);
+
+        __m256d scale = _mm256_and_pd(_mm256_div_pd(hundred, sum), _mm256_cmp_pd(sum, zero, _CMP_GT_OQ));
+        for (size_t r=0; r < rows; r++) {
+            size_t k = r * count + i;
+            _mm256_storeu_pd(percent + k, _mm256_mul_pd(_mm256_loadu_pd(table + k), scale));
+        }
+    }
+    columnPercentsScalar(table, rows, count, total, percent, i);
+}
+
+static bool hasAVX2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#else
+static void counterDeltasPlain(const double* curr, double* prev, double* delta, size_t count)
+{
+    counterDeltasScalar(curr, prev, delta, 0, count);
+}
+
+static void columnPercentsPlain(const double* table, size_t rows, size_t count, double* total, double* percent)
+{
+    columnPercentsScalar(table, rows, count, total, percent, 0);
+}
+#endif // __SSE2__
+
+static CounterDeltasFunc selectCounterDeltas()
+{
+#if defined(__SSE2__)
+    return hasAVX2() ? counterDeltasAVX2 : counterDeltasSSE2;
+#else
+    return counterDeltasPlain;
+#endif
+}
+
+void counterDeltas(const double* curr, double* prev, double* delta, size_t count)
+{
+    static CounterDeltasFunc func = selectCounterDeltas();
+    func(curr, prev, delta, count);
+}
+
+static ColumnPercentsFunc selectColumnPercents()
+{
+#if defined(__SSE2__)
+    return hasAVX2() ? columnPercentsAVX2 : columnPercentsSSE2;
+#else
+    return columnPercentsPlain;
+#endif
+}
+
+void columnPercents(const double* table, size_t rows, size_t count, double* total, double* percent)
+{
+    static ColumnPercentsFunc func = selectColumnPercents();
+    func(table, rows, count, total, percent);
+}
+
+const char* simdLevel()
+{
+#if defined(__SSE2__)
+    return hasAVX2() ? "AVX2" : "SSE2";
+#else
+    return "none";
+#endif
+}
+
+} // namespace lincore
@@ -0,0 +1,44 @@
+/**********************************************
+   File:   simd_kernels.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <stddef.h>
+
+/************************************
+ * Array kernels with SSE2 and AVX2 versions, the widest one the
+ * CPU supports is picked on the first call. Targets without SSE2
+ * get the scalar loops.
+ ************************************/
+namespace lincore {
+
+// delta[i] = max(curr[i] - prev[i], 0), 0 if either is NaN; prev[i] = curr[i]
+void counterDeltas(const double* curr, double* prev, double* delta, size_t count);
+
+// table holds `rows` arrays of `count` values each (row r, column i
+// at r * count + i). total[i] = sum of column i and
+// percent[r * count + i] = table[r * count + i] * 100 / total[i],
+// or 0 where the total is 0.
+void columnPercents(const double* table, size_t rows, size_t count, double* total, double* percent);
+
+const char* simdLevel();
+
+} // namespace lincore
+
+#endif // SIMD_KERNELS_H
@@ -0,0 +1,234 @@
+/**********************************************
+   File:   sock_diag.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "sock_diag.h"
+#include "utils/exception.h"
+#include "utils/misc.h"
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+using std::string;
+using namespace cdb;
+
+namespace lincore {
+
+static const size_t RECEIVE_BUFFER_SIZE = 65536;
+static const int RECEIVE_TIMEOUT_SEC = 1;
+
+// Request sockets of a listener, reported like SYN_RECV
+static const int TCP_NEW_SYN_RECV_STATE = 12;
+static const unsigned int ALL_STATES = ~0U;
+
+SockDiag::~SockDiag()
+{
+    close();
+}
+
+void SockDiag::setPorts(const vector< int >& ports)
+{
+    m_ports = ports;
+    m_portStats.assign(m_ports.size(), TcpPort());
+}
+
+void SockDiag::open()
+{
+    m_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (m_fd < 0) THROW("Failed to open sock_diag socket: " + getSystemError());
+
+    struct timeval tv = { RECEIVE_TIMEOUT_SEC, 0 };
+    setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_nl local;
+    memset(&local, 0, sizeof(local));
+    local.nl_family = AF_NETLINK;
+    if (bind(m_fd, (struct sockaddr*) &local, sizeof(local)) != 0) {
+        string error = getSystemError();
+        close();
+        THROW("Failed to bind sock_diag socket: " + error);
+    }
+
+    m_buffer.resize(RECEIVE_BUFFER_SIZE);
+}
+
+void SockDiag::close()
+{
+    if (m_fd < 0) return;
+    ::close(m_fd);
+    m_fd = -1;
+}
+
+void SockDiag::dump()
+{
+    if (m_fd < 0) open();
+
+    m_states = TcpStates();
+    m_histogram = TcpHistogram();
+    m_portStats.assign(m_ports.size(), TcpPort());
+
+    try {
+        if (!dump(AF_INET)) THROW("inet_diag does not support TCP");
+        // No IPv6 in the kernel is fine
+        dump(AF_INET6);
+    }
+    catch(Exception&) {
+        close();
+        throw;
+    }
+}
+
+bool SockDiag::dump(int family)
+{
+    request(family);
+
+    bool supported = true;
+    while (receive(supported));
+    return supported;
+}
+
+void SockDiag::request(int family)
+{
+    struct {
+        struct nlmsghdr m_header;
+        struct inet_diag_req_v2 m_req;
+    } req;
+
+    memset(&req, 0, sizeof(req));
+    req.m_header.nlmsg_len = NLMSG_LENGTH(sizeof(struct inet_diag_req_v2));
+    req.m_header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    req.m_header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.m_header.nlmsg_seq = ++m_seq;
+    req.m_req.sdiag_family = family;
+    req.m_req.sdiag_protocol = IPPROTO_TCP;
+    req.m_req.idiag_states = ALL_STATES;
+    if (m_info) req.m_req.idiag_ext = 1 << (INET_DIAG_INFO - 1);
+
+    struct sockaddr_nl kernel;
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+
+    ssize_t n;
+    do {
+        n = sendto(m_fd, &req, req.m_header.nlmsg_len, 0, (struct sockaddr*) &kernel, sizeof(kernel));
+    } while ((n < 0) && (errno == EINTR));
+    if (n < 0) THROW("Failed to request sockets: " + getSystemError());
+}
+
+bool SockDiag::receive(bool& supported)
+{
+    ssize_t n;
+    do {
+        n = recv(m_fd, &m_buffer[0], m_buffer.size(), 0);
+    } while ((n < 0) && (errno == EINTR));
+    if (n < 0) THROW("Failed to receive sockets: " + getSystemError());
+
+    int length = (int) n;
+    struct nlmsghdr* header = (struct nlmsghdr*) &m_buffer[0];
+    for ( ; NLMSG_OK(header, length); header = NLMSG_NEXT(header, length)) {
+        if (header->nlmsg_seq != m_seq) continue;
+
+        if (header->nlmsg_type == NLMSG_DONE) return false;
+        if (header->nlmsg_type == NLMSG_ERROR) {
+            struct nlmsgerr* err = (struct nlmsgerr*) NLMSG_DATA(header);
+            // The family module is not loaded
+            if (err->error == -ENOENT) {
+                supported = false;
+                return false;
+            }
+            errno = -err->error;
+            THROW("Socket dump failed: " + getSystemError());
+        }
+        if (header->nlmsg_type != SOCK_DIAG_BY_FAMILY) continue;
+
+        count(header);
+    }
+    return true;
+}
+
+void SockDiag::count(const void* message)
+{
+    struct nlmsghdr* header = (struct nlmsghdr*) message;
+    struct inet_diag_msg* msg = (struct inet_diag_msg*) NLMSG_DATA(header);
+
+    switch (msg->idiag_state) {
+    case TCP_ESTABLISHED: m_states.established++; break;
+    case TCP_SYN_SENT:    m_states.synSent++; break;
+    case TCP_SYN_RECV:
+    case TCP_NEW_SYN_RECV_STATE:
+                          m_states.synRecv++; break;
+    case TCP_FIN_WAIT1:   m_states.finWait1++; break;
+    case TCP_FIN_WAIT2:   m_states.finWait2++; break;
+    case TCP_TIME_WAIT:   m_states.timeWait++; break;
+    case TCP_CLOSE:       m_states.closed++; break;
+    case TCP_CLOSE_WAIT:  m_states.closeWait++; break;
+    case TCP_LAST_ACK:    m_states.lastAck++; break;
+    case TCP_LISTEN:      m_states.listen++; break;
+    case TCP_CLOSING:     m_states.closing++; break;
+    }
+
+    if ((msg->idiag_state == TCP_LISTEN) && !m_ports.empty()) {
+        int port = ntohs(msg->id.idiag_sport);
+        vector< int >::iterator iter = std::lower_bound(m_ports.begin(), m_ports.end(), port);
+        if ((iter != m_ports.end()) && (*iter == port)) {
+            // For a listener rqueue is the accept queue and wqueue its limit
+            TcpPort& stats = m_portStats[iter - m_ports.begin()];
+            stats.acceptQueue += msg->idiag_rqueue;
+            stats.backlog += msg->idiag_wqueue;
+        }
+    }
+
+    if (!m_info || (msg->idiag_state != TCP_ESTABLISHED)) return;
+
+    int length = header->nlmsg_len - NLMSG_LENGTH(sizeof(*msg));
+    struct rtattr* attr = (struct rtattr*) (msg + 1);
+    for ( ; RTA_OK(attr, length); attr = RTA_NEXT(attr, length)) {
+        if (attr->rta_type != INET_DIAG_INFO) continue;
+
+        // Older kernels send a shorter tcp_info
+        struct tcp_info info;
+        memset(&info, 0, sizeof(info));
+        memcpy(&info, RTA_DATA(attr), std::min((size_t) RTA_PAYLOAD(attr), sizeof(info)));
+
+        unsigned int rtt = info.tcpi_rtt;     // microseconds
+        if (rtt < 1000) m_histogram.rtt1ms++;
+        else if (rtt < 10000) m_histogram.rtt10ms++;
+        else if (rtt < 100000) m_histogram.rtt100ms++;
+        else if (rtt < 1000000) m_histogram.rtt1s++;
+        else m_histogram.rttOver++;
+
+        if (info.tcpi_retransmits != 0) m_histogram.retransmitting++;
+        unsigned int retrans = info.tcpi_total_retrans;
+        if (retrans >= 100) m_histogram.retrans100++;
+        else if (retrans >= 10) m_histogram.retrans10++;
+        else if (retrans >= 1) m_histogram.retrans1++;
+        break;
+    }
+}
+
+} // namespace lincore
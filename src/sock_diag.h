@@ -0,0 +1,121 @@
+/**********************************************
+   File:   sock_diag.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef SOCK_DIAG_H
+#define SOCK_DIAG_H
+
+#include <stddef.h>
+#include <vector>
+
+using std::vector;
+
+namespace lincore {
+
+struct TcpStates
+{
+    TcpStates() : established(0), synSent(0), synRecv(0), finWait1(0), finWait2(0),
+                  timeWait(0), closed(0), closeWait(0), lastAck(0), listen(0), closing(0) {}
+    double established;
+    double synSent;
+    double synRecv;
+    double finWait1;
+    double finWait2;
+    double timeWait;
+    double closed;
+    double closeWait;
+    double lastAck;
+    double listen;
+    double closing;
+};
+
+// Established sockets by smoothed RTT and by retransmits so far
+struct TcpHistogram
+{
+    TcpHistogram() : rtt1ms(0), rtt10ms(0), rtt100ms(0), rtt1s(0), rttOver(0),
+                     retransmitting(0), retrans1(0), retrans10(0), retrans100(0) {}
+    double rtt1ms;
+    double rtt10ms;
+    double rtt100ms;
+    double rtt1s;
+    double rttOver;
+    double retransmitting;  // in RTO backoff right now
+    double retrans1;        // 1 to 9 segments retransmitted
+    double retrans10;       // 10 to 99
+    double retrans100;      // 100 and more
+};
+
+// Listeners on one port, IPv4 and IPv6 summed up
+struct TcpPort
+{
+    TcpPort() : acceptQueue(0), backlog(0) {}
+    double acceptQueue;     // connections waiting for accept()
+    double backlog;         // limit of the accept queue
+};
+
+/************************************
+ * TCP socket statistics from inet_diag dumps over a NETLINK_SOCK_DIAG
+ * socket that stays open. Sockets are counted as the messages arrive,
+ * so memory does not grow with the number of sockets. The RTT and
+ * retransmit histogram needs INET_DIAG_INFO, which makes the kernel
+ * fill a tcp_info for every socket, so it is optional.
+ ************************************/
+class SockDiag
+{
+public:
+    SockDiag() : m_fd(-1), m_seq(0), m_info(false) {}
+    ~SockDiag();
+
+    void setInfo(bool info) { m_info = info; }
+    // Listening ports to report the accept queue of
+    void setPorts(const vector< int >& ports);
+
+    // Throws if the dump fails, the socket is reopened on the next call
+    void dump();
+
+    const TcpStates& states() { return m_states; }
+    const TcpHistogram& histogram() { return m_histogram; }
+    const TcpPort& port(size_t index) { return m_portStats[index]; }
+
+private:
+    int m_fd;
+    unsigned int m_seq;
+    bool m_info;
+    vector< int > m_ports;
+    vector< char > m_buffer;
+
+    TcpStates m_states;
+    TcpHistogram m_histogram;
+    vector< TcpPort > m_portStats;
+
+private:
+    SockDiag(const SockDiag&);
+    SockDiag& operator=(const SockDiag&);
+
+    void open();
+    void close();
+    // False if the kernel does not know the family
+    bool dump(int family);
+    void request(int family);
+    // False once the dump is complete
+    bool receive(bool& supported);
+    void count(const void* message);
+};
+
+} // namespace lincore
+
+#endif // SOCK_DIAG_H
@@ -0,0 +1,418 @@
+/**********************************************
+   File:   spool.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "spool.h"
+#include "utils/config.h"
+#include "utils/exception.h"
+#include "utils/log.h"
+#include "utils/misc.h"
+#include "utils/perf.h"
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace cdb;
+
+namespace lincore {
+
+static const int DEFAULT_SPOOL_SIZE_MB = 64;
+static const uint32_t CURSOR_MAGIC = 0x4c435350;   // "LCSP"
+static const size_t RECORD_ALIGN = 8;
+
+struct RecordHeader
+{
+    uint32_t m_length;
+    uint32_t m_checksum;
+    int32_t  m_ts;
+    uint32_t m_type;
+};
+
+struct Cursor
+{
+    uint32_t m_magic;
+    uint32_t m_segment;
+    uint64_t m_offset;
+    uint32_t m_checksum;
+};
+
+static uint32_t checksum(uint32_t hash, const void* data, size_t length)
+{
+    // FNV-1a
+    const unsigned char* p = (const unsigned char*) data;
+    for (size_t i=0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static uint32_t recordChecksum(int type, int ts, const char* data, size_t length)
+{
+    uint32_t hash = 2166136261U;
+    int32_t ts32 = ts;
+    uint32_t type32 = type;
+    hash = checksum(hash, &ts32, sizeof(ts32));
+    hash = checksum(hash, &type32, sizeof(type32));
+    return checksum(hash, data, length);
+}
+
+static size_t recordSize(size_t length)
+{
+    size_t size = sizeof(RecordHeader) + length;
+    return (size + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+}
+
+Spool::~Spool()
+{
+    if (m_read != m_write) unmapSegment(m_read);
+    unmapSegment(m_write);
+}
+
+void Spool::init()
+{
+    Config::instance().get("spool", m_dir);
+    if (m_dir.empty()) return;
+
+    int sizeMb = DEFAULT_SPOOL_SIZE_MB;
+    Config::instance().get("spool_size", sizeMb);
+    if (sizeMb <= 0) THROW("Invalid spool_size");
+    m_maxSegments = ((size_t) sizeMb * 1024 * 1024) / SEGMENT_SIZE;
+    if (m_maxSegments < 2) m_maxSegments = 2;
+
+    if ((mkdir(m_dir.c_str(), 0755) != 0) && (errno != EEXIST)) {
+        THROW("Failed to create spool directory " + m_dir + ": " + getSystemError());
+    }
+
+    DIR* dir = opendir(m_dir.c_str());
+    if (dir == NULL) THROW("Failed to open spool directory " + m_dir + ": " + getSystemError());
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned int id;
+        if (sscanf(entry->d_name, "seg-%u", &id) == 1) m_segments.push_back(id);
+    }
+    closedir(dir);
+    std::sort(m_segments.begin(), m_segments.end());
+    if (!m_segments.empty()) m_lastId = m_segments.back();
+
+    loadCursor();
+    if (m_lastId < m_cursorSegment) m_lastId = m_cursorSegment;
+
+    // Everything before the cursor was delivered already
+    while (!m_segments.empty() && (m_segments.front() < m_cursorSegment)) {
+        removeSegment(m_segments.front());
+        m_segments.pop_front();
+    }
+
+    m_readId = m_cursorSegment;
+    m_readOffset = m_cursorOffset;
+    m_writtenSegment = m_cursorSegment;
+    m_writtenOffset = m_cursorOffset;
+    m_evictedCounter = Perf::instance().counter("lincore.spool_evicted");
+    m_enabled = true;
+
+    LOG_INFO << "Spooling to " << m_dir << ", " << m_segments.size() << " segment(s) on disk";
+}
+
+string Spool::segmentPath(uint32_t id)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/seg-%010u", id);
+    return m_dir + name;
+}
+
+Spool::Segment* Spool::mapSegment(uint32_t id, bool create)
+{
+    string path = segmentPath(id);
+    int fd = open(path.c_str(), create ? (O_RDWR | O_CREAT) : O_RDWR, 0644);
+    if (fd < 0) {
+        LOG_ERROR << "Failed to open spool segment " << path << ": " << getSystemError();
+        return 0;
+    }
+    if (create && (ftruncate(fd, SEGMENT_SIZE) != 0)) {
+        LOG_ERROR << "Failed to size spool segment " << path << ": " << getSystemError();
+        close(fd);
+        return 0;
+    }
+
+    void* data = mmap(NULL, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        LOG_ERROR << "Failed to map spool segment " << path << ": " << getSystemError();
+        return 0;
+    }
+
+    Segment* segment = new Segment;
+    segment->m_id = id;
+    segment->m_data = (char*) data;
+    return segment;
+}
+
+void Spool::unmapSegment(Segment*& segment)
+{
+    if (segment == 0) return;
+    msync(segment->m_data, SEGMENT_SIZE, MS_ASYNC);
+    munmap(segment->m_data, SEGMENT_SIZE);
+    delete segment;
+    segment = 0;
+}
+
+void Spool::removeSegment(uint32_t id)
+{
+    string path = segmentPath(id);
+    if (unlink(path.c_str()) != 0) {
+        LOG_WARN << "Failed to remove spool segment " << path << ": " << getSystemError();
+    }
+}
+
+void Spool::append(int ts, const string& row, const string& header)
+{
+    if (!m_enabled) return;
+
+    // Every segment starts with the header of its rows, so eviction
+    // and restarts never leave rows without their header
+    if (m_write == 0) {
+        m_header = header;
+        openWriteSegment();
+    }
+    else if (header != m_header) {
+        m_header = header;
+        if (!write(SPOOL_HEADER, 0, header.data(), header.length())) openWriteSegment();
+    }
+    if (m_write == 0) return;
+
+    if (write(SPOOL_ROW, ts, row.data(), row.length())) return;
+
+    openWriteSegment();
+    if ((m_write != 0) && !write(SPOOL_ROW, ts, row.data(), row.length())) {
+        LOG_WARN << "Row of " << row.length() << " bytes does not fit into a spool segment";
+    }
+}
+
+void Spool::openWriteSegment()
+{
+    if (m_write != m_read) unmapSegment(m_write);
+    m_write = 0;
+
+    while (m_segments.size() >= m_maxSegments) evict();
+
+    uint32_t id = m_lastId + 1;
+    m_write = mapSegment(id, true);
+    if (m_write == 0) {
+        LOG_ERROR << "Spool is disabled";
+        m_enabled = false;
+        return;
+    }
+    m_lastId = id;
+    m_segments.push_back(id);
+    m_writeOffset = 0;
+
+    write(SPOOL_HEADER, 0, m_header.data(), m_header.length());
+}
+
+bool Spool::write(int type, int ts, const char* data, size_t length)
+{
+    size_t size = recordSize(length);
+    if (m_writeOffset + size > SEGMENT_SIZE) return false;
+
+    RecordHeader* rh = (RecordHeader*) (m_write->m_data + m_writeOffset);
+    memcpy(rh + 1, data, length);
+    rh->m_ts = ts;
+    rh->m_type = type;
+    rh->m_checksum = recordChecksum(type, ts, data, length);
+    // A non-zero length is what makes the record visible
+    __atomic_store_n(&rh->m_length, (uint32_t) length, __ATOMIC_RELEASE);
+
+    m_writeOffset += size;
+    return true;
+}
+
+void Spool::evict()
+{
+    uint32_t id = m_segments.front();
+    m_segments.pop_front();
+    uint32_t next = m_segments.empty() ? m_lastId + 1 : m_segments.front();
+
+    if (m_readId <= id) {
+        if (m_read != m_write) unmapSegment(m_read);
+        m_read = 0;
+        m_readId = next;
+        m_readOffset = 0;
+    }
+    if (m_writtenSegment <= id) {
+        m_writtenSegment = next;
+        m_writtenOffset = 0;
+    }
+    if (m_cursorSegment <= id) {
+        m_cursorSegment = next;
+        m_cursorOffset = 0;
+        saveCursor();
+    }
+
+    removeSegment(id);
+    Perf::instance().inc(m_evictedCounter, 1);
+    LOG_WARN << "Spool is full, evicted segment " << id;
+}
+
+bool Spool::readable()
+{
+    for (;;) {
+        if (m_segments.empty()) return false;
+
+        if (m_read == 0) {
+            deque< uint32_t >::iterator iter =
+                std::lower_bound(m_segments.begin(), m_segments.end(), m_readId);
+            if (iter == m_segments.end()) return false;
+            if (*iter != m_readId) {
+                m_readId = *iter;
+                m_readOffset = 0;
+            }
+            m_read = ((m_write != 0) && (m_write->m_id == m_readId)) ? m_write : mapSegment(m_readId, false);
+            if (m_read == 0) {
+                m_enabled = false;
+                return false;
+            }
+        }
+
+        if (m_readOffset + sizeof(RecordHeader) <= SEGMENT_SIZE) {
+            RecordHeader* rh = (RecordHeader*) (m_read->m_data + m_readOffset);
+            uint32_t length = __atomic_load_n(&rh->m_length, __ATOMIC_ACQUIRE);
+            if ((length != 0) && (m_readOffset + recordSize(length) <= SEGMENT_SIZE) &&
+                (rh->m_checksum == recordChecksum(rh->m_type, rh->m_ts, (char*) (rh + 1), length))) {
+                return true;
+            }
+        }
+
+        // End of segment: move on unless the writer may still extend it
+        if (m_readId >= m_segments.back()) return false;
+
+        if (m_read != m_write) unmapSegment(m_read);
+        m_read = 0;
+        m_readId++;
+        m_readOffset = 0;
+    }
+}
+
+bool Spool::pending()
+{
+    return m_enabled && readable();
+}
+
+bool Spool::next(SpoolRecord& record)
+{
+    if (!pending()) return false;
+
+    RecordHeader* rh = (RecordHeader*) (m_read->m_data + m_readOffset);
+    record.m_type = rh->m_type;
+    record.m_ts = rh->m_ts;
+    record.m_data = (const char*) (rh + 1);
+    record.m_length = rh->m_length;
+
+    m_readOffset += recordSize(rh->m_length);
+    return true;
+}
+
+void Spool::commit()
+{
+    if (!m_enabled) return;
+
+    uint32_t segment = m_writtenSegment;
+    size_t offset = m_writtenOffset;
+    m_writtenSegment = m_readId;
+    m_writtenOffset = m_readOffset;
+    if ((m_cursorSegment == segment) && (m_cursorOffset == offset)) return;
+
+    m_cursorSegment = segment;
+    m_cursorOffset = offset;
+    saveCursor();
+
+    while (!m_segments.empty() && (m_segments.front() < m_cursorSegment)) {
+        removeSegment(m_segments.front());
+        m_segments.pop_front();
+    }
+}
+
+void Spool::rewind()
+{
+    if (!m_enabled) return;
+    if (m_readId != m_cursorSegment) {
+        if (m_read != m_write) unmapSegment(m_read);
+        m_read = 0;
+    }
+    m_readId = m_cursorSegment;
+    m_readOffset = m_cursorOffset;
+    m_writtenSegment = m_cursorSegment;
+    m_writtenOffset = m_cursorOffset;
+}
+
+void Spool::loadCursor()
+{
+    m_cursorSegment = m_segments.empty() ? 0 : m_segments.front();
+    m_cursorOffset = 0;
+
+    string path = m_dir + "/cursor";
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+
+    Cursor cursor;
+    ssize_t ret = read(fd, &cursor, sizeof(cursor));
+    close(fd);
+
+    if ((ret != sizeof(cursor)) || (cursor.m_magic != CURSOR_MAGIC) ||
+        (cursor.m_checksum != checksum(2166136261U, &cursor, offsetof(Cursor, m_checksum)))) {
+        LOG_WARN << "Ignoring damaged spool cursor " << path;
+        return;
+    }
+
+    // Segment of the cursor could have been evicted meanwhile
+    if (cursor.m_segment < m_cursorSegment) return;
+    m_cursorSegment = cursor.m_segment;
+    m_cursorOffset = cursor.m_offset;
+}
+
+void Spool::saveCursor()
+{
+    Cursor cursor;
+    memset(&cursor, 0, sizeof(cursor));
+    cursor.m_magic = CURSOR_MAGIC;
+    cursor.m_segment = m_cursorSegment;
+    cursor.m_offset = m_cursorOffset;
+    cursor.m_checksum = checksum(2166136261U, &cursor, offsetof(Cursor, m_checksum));
+
+    // Written aside and renamed, so the cursor file is always complete
+    string path = m_dir + "/cursor";
+    string tmpPath = path + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG_ERROR << "Failed to save spool cursor: " << getSystemError();
+        return;
+    }
+    bool ok = (::write(fd, &cursor, sizeof(cursor)) == sizeof(cursor)) && (fdatasync(fd) == 0);
+    close(fd);
+    if (!ok || (rename(tmpPath.c_str(), path.c_str()) != 0)) {
+        LOG_ERROR << "Failed to save spool cursor: " << getSystemError();
+    }
+}
+
+} // namespace lincore
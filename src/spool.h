@@ -0,0 +1,128 @@
+/**********************************************
+   File:   spool.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <deque>
+
+using std::string;
+using std::deque;
+
+namespace lincore {
+
+enum SpoolRecordType
+{
+    SPOOL_HEADER = 'H',     // insert header the following rows belong to
+    SPOOL_ROW = 'R'
+};
+
+struct SpoolRecord
+{
+    int m_type;
+    int m_ts;
+    const char* m_data;
+    size_t m_length;
+};
+
+/************************************
+ * Append-only on-disk queue of rows produced while ClockWorkDB
+ * is unreachable. Rows go into fixed size mmap'ed segment files,
+ * the oldest segment is evicted when the size cap is reached.
+ * The protocol has no acknowledgements, so rows written to the socket
+ * count as delivered only once a later write succeeds: the read
+ * position is persisted in a cursor file one commit late, and a lost
+ * connection or a crash replays rather than loses the rows still in
+ * the socket buffers.
+ ************************************/
+class Spool
+{
+public:
+    Spool() : m_enabled(false), m_maxSegments(0), m_lastId(0), m_write(0), m_writeOffset(0),
+              m_read(0), m_readId(0), m_readOffset(0), m_cursorSegment(0), m_cursorOffset(0),
+              m_writtenSegment(0), m_writtenOffset(0), m_evictedCounter(0) {}
+    ~Spool();
+
+    void init();
+    bool enabled() { return m_enabled; }
+
+    void append(int ts, const string& row, const string& header);
+
+    // Records which were appended but not read yet
+    bool pending();
+    bool next(SpoolRecord& record);
+
+    // Everything read so far was written out, which confirms the rows
+    // of the previous commit; those are persisted and their segments
+    // removed. rewind() goes back to the last persisted position.
+    void commit();
+    void rewind();
+
+private:
+    struct Segment
+    {
+        uint32_t m_id;
+        char* m_data;
+    };
+
+    static const size_t SEGMENT_SIZE = 4 * 1024 * 1024;
+
+private:
+    bool m_enabled;
+    string m_dir;
+    size_t m_maxSegments;
+    deque< uint32_t > m_segments;
+    uint32_t m_lastId;
+    string m_header;
+
+    Segment* m_write;
+    size_t m_writeOffset;
+
+    Segment* m_read;
+    uint32_t m_readId;
+    size_t m_readOffset;
+
+    uint32_t m_cursorSegment;
+    size_t m_cursorOffset;
+
+    uint32_t m_writtenSegment;  // read position of the last commit
+    size_t m_writtenOffset;
+
+    long* m_evictedCounter;
+
+private:
+    string segmentPath(uint32_t id);
+    Segment* mapSegment(uint32_t id, bool create);
+    void unmapSegment(Segment*& segment);
+    void removeSegment(uint32_t id);
+
+    void openWriteSegment();
+    bool write(int type, int ts, const char* data, size_t length);
+    void evict();
+
+    bool readable();
+    void loadCursor();
+    void saveCursor();
+};
+
+} // namespace lincore
+
+#endif // SPOOL_H
@@ -0,0 +1,146 @@
+/**********************************************
+   File:   ticker.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "ticker.h"
+#include "utils/config.h"
+#include "utils/exception.h"
+#include "utils/log.h"
+#include "utils/misc.h"
+#include "utils/perf.h"
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+using namespace cdb;
+
+namespace lincore {
+
+static const long NSEC_PER_SEC = 1000000000L;
+
+Ticker::~Ticker()
+{
+    if (m_fd >= 0) close(m_fd);
+}
+
+void Ticker::init()
+{
+    string catchUp = "coalesce";
+    Config::instance().get("catchup", catchUp);
+    if (catchUp == "coalesce") m_catchUp = CATCHUP_COALESCE;
+    else if (catchUp == "skip") m_catchUp = CATCHUP_SKIP;
+    else THROW("Invalid catchup policy: " + catchUp);
+
+    m_missedCounter = Perf::instance().counter("lincore.missed_ticks");
+
+    if (m_fd >= 0) return;
+    m_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (m_fd < 0) {
+        LOG_WARN << "timerfd is not available, falling back to clock_nanosleep";
+    }
+}
+
+void Ticker::start()
+{
+    anchor();
+}
+
+void Ticker::anchor()
+{
+    struct timespec rt, mono;
+    clock_gettime(CLOCK_REALTIME, &rt);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+
+    // First deadline is the next wall clock second boundary
+    m_start.tv_sec = mono.tv_sec + 1;
+    m_start.tv_nsec = mono.tv_nsec - rt.tv_nsec;
+    if (m_start.tv_nsec < 0) {
+        m_start.tv_sec--;
+        m_start.tv_nsec += NSEC_PER_SEC;
+    }
+    m_startTs = (int) rt.tv_sec + 1;
+    m_tick = 0;
+    m_ts = m_startTs - 1;
+    m_prevTs = m_ts - 1;
+
+    if (m_fd < 0) return;
+
+    struct itimerspec spec;
+    spec.it_value = m_start;
+    spec.it_interval.tv_sec = 1;
+    spec.it_interval.tv_nsec = 0;
+    if (timerfd_settime(m_fd, TFD_TIMER_ABSTIME, &spec, NULL) != 0) {
+        THROW("Failed to arm tick timer: " + getSystemError());
+    }
+}
+
+long Ticker::expirations()
+{
+    if (m_fd >= 0) {
+        uint64_t count = 0;
+        ssize_t ret = read(m_fd, &count, sizeof(count));
+        if (ret == sizeof(count)) return (long) count;
+        if ((ret < 0) && (errno == EINTR)) return 0;
+        THROW("Failed to read tick timer: " + getSystemError());
+    }
+
+    struct timespec next = m_start;
+    next.tv_sec += m_tick;
+    int ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    if (ret == EINTR) return 0;
+    if (ret != 0) THROW("Failed to sleep until next tick");
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long passed = now.tv_sec - m_start.tv_sec;
+    if (now.tv_nsec < m_start.tv_nsec) passed--;
+    passed = passed + 1 - m_tick;
+    return (passed < 1) ? 1 : passed;
+}
+
+bool Ticker::wait()
+{
+    long count = expirations();
+    if (count == 0) return false;
+
+    m_tick += count;
+    int ts = m_startTs + (int) m_tick - 1;
+
+    if (count > 1) {
+        m_missed += count - 1;
+        Perf::instance().inc(m_missedCounter, count - 1);
+        LOG_WARN << "Missed " << (count - 1) << " tick deadline(s) before " << ts;
+    }
+
+    // Wall clock was stepped or the host was frozen for too long:
+    // start a new phase instead of catching up
+    int now = (int) time(NULL);
+    if ((count > MAX_CATCHUP) || (now > ts + 1) || (now < ts - 1)) {
+        LOG_WARN << "Tick schedule is off the wall clock by " << (now - ts) << "s, re-anchoring";
+        anchor();
+        m_ts = now;
+        m_prevTs = now - 1;
+        return true;
+    }
+
+    m_prevTs = (m_catchUp == CATCHUP_COALESCE) ? m_ts : ts - 1;
+    m_ts = ts;
+    return true;
+}
+
+} // namespace lincore
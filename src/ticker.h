@@ -0,0 +1,76 @@
+/**********************************************
+   File:   ticker.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef TICKER_H
+#define TICKER_H
+
+#include <time.h>
+
+namespace lincore {
+
+/************************************
+ * One second scheduler driven by absolute CLOCK_MONOTONIC deadlines.
+ * Deadlines are anchored on wall clock second boundaries, so the time
+ * spent collecting and sending does not shift the next tick.
+ ************************************/
+class Ticker
+{
+public:
+    // What to report as the previous tick after deadlines were missed
+    enum CatchUp {
+        CATCHUP_COALESCE,   // one row covering every missed tick
+        CATCHUP_SKIP        // missed ticks are dropped
+    };
+
+public:
+    Ticker() : m_fd(-1), m_catchUp(CATCHUP_COALESCE), m_ts(0), m_prevTs(0),
+               m_tick(0), m_missed(0), m_missedCounter(0) {}
+    ~Ticker();
+
+    void init();
+    void start();
+
+    // Blocks until the next deadline, returns false if interrupted
+    bool wait();
+
+    int ts() { return m_ts; }
+    int prevTs() { return m_prevTs; }
+    long missed() { return m_missed; }
+
+private:
+    static const int MAX_CATCHUP = 3600;
+
+private:
+    int m_fd;
+    CatchUp m_catchUp;
+    struct timespec m_start;
+    int m_startTs;
+    int m_ts;
+    int m_prevTs;
+    long m_tick;
+    long m_missed;
+    long* m_missedCounter;
+
+private:
+    long expirations();
+    void anchor();
+};
+
+} // namespace lincore
+
+#endif // TICKER_H
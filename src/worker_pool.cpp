@@ -0,0 +1,100 @@
+/**********************************************
+   File:   worker_pool.cpp
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#include "worker_pool.h"
+#include "utils/exception.h"
+#include "utils/log.h"
+#include <new>
+#include <stdlib.h>
+
+using namespace cdb;
+
+namespace lincore {
+
+static const int WAIT_TIMEOUT_MS = 1000;
+static const int JOIN_TIMEOUT_MS = 500;
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+void WorkerPool::start(int threads)
+{
+    if (started()) return;
+
+    // The queues are cache line aligned, plain new does not honour that
+    void* memory = 0;
+    if (posix_memalign(&memory, CDB_CACHE_LINE, sizeof(State)) != 0) THROW("Failed to allocate worker queues");
+    m_state = new (memory) State();
+    for (int i=0; i < threads; i++) {
+        m_threads.push_back(new boost::thread(&WorkerPool::run, m_state));
+    }
+}
+
+void WorkerPool::stop()
+{
+    if (!started()) return;
+    __atomic_store_n(&m_state->m_keepGoing, false, __ATOMIC_RELEASE);
+    m_state->m_jobs.wakeAll();
+
+    bool stuck = false;
+    for (size_t i=0; i < m_threads.size(); i++) {
+        if (!m_threads[i]->timed_join(boost::posix_time::milliseconds(JOIN_TIMEOUT_MS))) {
+            LOG_WARN << "Worker thread is stuck in a job, leaving it behind";
+            m_threads[i]->detach();
+            stuck = true;
+        }
+        delete m_threads[i];
+    }
+    m_threads.clear();
+
+    // A thread left behind still puts its job on the done queue
+    if (!stuck) {
+        m_state->~State();
+        free(m_state);
+    }
+    m_state = 0;
+}
+
+bool WorkerPool::submit(Job* job)
+{
+    if (m_state == 0) return false;
+    return m_state->m_jobs.put(job);
+}
+
+Job* WorkerPool::finished(int timeoutMs)
+{
+    if (m_state == 0) return 0;
+    void* job = 0;
+    if (!m_state->m_done.get(job, timeoutMs)) return 0;
+    return (Job*) job;
+}
+
+void WorkerPool::run(State* state)
+{
+    while (__atomic_load_n(&state->m_keepGoing, __ATOMIC_ACQUIRE)) {
+        void* job = 0;
+        if (!state->m_jobs.get(job, WAIT_TIMEOUT_MS)) continue;
+
+        ((Job*) job)->run();
+        state->m_done.put(job);
+    }
+}
+
+} // namespace lincore
@@ -0,0 +1,86 @@
+/**********************************************
+   File:   worker_pool.h
+
+   Copyright 2013 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include "utils/queue.h"
+#include <boost/thread/thread.hpp>
+#include <vector>
+
+using std::vector;
+
+namespace lincore {
+
+class Job
+{
+public:
+    virtual ~Job() {}
+    // Called on a worker thread, must not throw
+    virtual void run() = 0;
+};
+
+/************************************
+ * A few threads for collectors that may block in the kernel, like
+ * statvfs on a dead NFS mount. Jobs go in through one queue and
+ * come back through another once run, so the collector thread can
+ * wait for them with a deadline and leave stuck ones behind.
+ * The queues live apart from the pool and are leaked once a
+ * thread is left behind, so a job finishing after the pool is
+ * gone still has somewhere to go. Whatever the job itself
+ * touches in run() must outlive it the same way.
+ ************************************/
+class WorkerPool
+{
+public:
+    WorkerPool() : m_state(0) {}
+    ~WorkerPool();
+
+    void start(int threads);
+    // Threads stuck in a job are detached, not joined
+    void stop();
+    bool started() { return !m_threads.empty(); }
+
+    // Returns false if the queue is full
+    bool submit(Job* job);
+    // Next finished job or 0 if none finished within the timeout
+    Job* finished(int timeoutMs);
+
+private:
+    struct State
+    {
+        State() : m_keepGoing(true) {}
+        cdb::Queue m_jobs;
+        cdb::Queue m_done;
+        bool m_keepGoing;
+    };
+
+private:
+    State* m_state;
+    vector< boost::thread* > m_threads;
+
+private:
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    static void run(State* state);
+};
+
+} // namespace lincore
+
+#endif // WORKER_POOL_H
@@ -0,0 +1,54 @@
+/**********************************************
+   File:   futex.h
+
+   Copyright 2012 Michael Popov
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ **********************************************/
+
+#ifndef CDB_UTILS_FUTEX_H
+#define CDB_UTILS_FUTEX_H
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace cdb {
+
+/************************************
+ * Process private futex on an int word. wait() returns at once
+ * if the word no longer holds the expected value.
+ ************************************/
+class Futex
+{
+public:
+    static void wait(int* addr, int value, int timeoutMs = -1) {
+        struct timespec ts;
+        struct timespec* timeout = 0;
+        if (timeoutMs >= 0) {
+            ts.tv_sec = timeoutMs / 1000;
+            ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+            timeout = &ts;
+        }
+        syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, timeout, 0, 0);
+    }
+
+    static void wake(int* addr, int count = 1) {
+        syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, 0, 0, 0);
+    }
+};
+
+} // namespace cdb
+
+#endif // CDB_UTILS_FUTEX_H
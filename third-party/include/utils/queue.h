@@ -21,9 +21,9 @@
 #ifndef CDB_SYSTEM_QUEUE_H
 #define CDB_SYSTEM_QUEUE_H
 
-#include <boost/thread/thread.hpp>
-#include <boost/thread/condition.hpp>
-#include <vector>
+#include "utils/futex.h"
+#include <stddef.h>
+#include <stdint.h>
 #include <iostream>
 
 using std::cout;
@@ -31,37 +31,123 @@ using std::endl;
 
 namespace cdb {
 
+#define CDB_CACHE_LINE 64
+
+/************************************
+ * Bounded multi producer / multi consumer queue. Every cell carries
+ * a sequence number telling whether it is free for the producer of
+ * that lap or holds a task for the consumer of that lap, so put and
+ * get only contend on a CAS of the head or tail index.
+ * get() blocks on a futex once the queue is empty; producers only
+ * make the wake call when somebody is waiting.
+ ************************************/
 class Queue {
 public:
-    Queue() : m_start(0), m_count(0) { m_tasks.resize(QUEUE_SIZE, 0); }
+    Queue() : m_tail(0), m_head(0), m_signal(0), m_waiters(0) {
+        for (size_t i=0; i < QUEUE_SIZE; i++) {
+            m_cells[i].m_seq = i;
+            m_cells[i].m_task = 0;
+        }
+    }
 
     bool put(void* task) {
-        if (m_count >= QUEUE_SIZE) return false;
-        boost::mutex::scoped_lock guard(m_mutex);
-        m_tasks[(m_start + m_count) % QUEUE_SIZE] = task;
-        m_count++;
-        m_cond.notify_one();
+        Cell* cell;
+        size_t pos = __atomic_load_n(&m_tail, __ATOMIC_RELAXED);
+        for (;;) {
+            cell = &m_cells[pos & QUEUE_MASK];
+            size_t seq = __atomic_load_n(&cell->m_seq, __ATOMIC_ACQUIRE);
+            intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+            if (diff == 0) {
+                if (__atomic_compare_exchange_n(&m_tail, &pos, pos + 1, true,
+                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = __atomic_load_n(&m_tail, __ATOMIC_RELAXED);
+            }
+        }
+        cell->m_task = task;
+        __atomic_store_n(&cell->m_seq, pos + 1, __ATOMIC_RELEASE);
+
+        notify();
+        return true;
+    }
+
+    bool tryGet(void*& task) {
+        Cell* cell;
+        size_t pos = __atomic_load_n(&m_head, __ATOMIC_RELAXED);
+        for (;;) {
+            cell = &m_cells[pos & QUEUE_MASK];
+            size_t seq = __atomic_load_n(&cell->m_seq, __ATOMIC_ACQUIRE);
+            intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+            if (diff == 0) {
+                if (__atomic_compare_exchange_n(&m_head, &pos, pos + 1, true,
+                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = __atomic_load_n(&m_head, __ATOMIC_RELAXED);
+            }
+        }
+        task = cell->m_task;
+        __atomic_store_n(&cell->m_seq, pos + QUEUE_SIZE, __ATOMIC_RELEASE);
         return true;
     }
 
     void* get() {
-        boost::mutex::scoped_lock guard(m_mutex);
-        while (m_count == 0) m_cond.wait(guard);
-        void* task = m_tasks[m_start];
-        m_start = (m_start + 1) % QUEUE_SIZE;
-        m_count--;
+        void* task = 0;
+        while (!get(task, -1));
         return task;
     }
 
+    // Returns false if nothing arrived within the timeout or on wakeAll()
+    bool get(void*& task, int timeoutMs) {
+        if (tryGet(task)) return true;
+
+        __atomic_add_fetch(&m_waiters, 1, __ATOMIC_SEQ_CST);
+        int signal = __atomic_load_n(&m_signal, __ATOMIC_SEQ_CST);
+        bool found = tryGet(task);
+        if (!found) {
+            Futex::wait(&m_signal, signal, timeoutMs);
+            found = tryGet(task);
+        }
+        __atomic_sub_fetch(&m_waiters, 1, __ATOMIC_RELAXED);
+        return found;
+    }
+
+    void wakeAll() {
+        __atomic_add_fetch(&m_signal, 1, __ATOMIC_SEQ_CST);
+        Futex::wake(&m_signal, INT_WAKE_ALL);
+    }
+
 private:
     static const size_t QUEUE_SIZE = 1024;
+    static const size_t QUEUE_MASK = QUEUE_SIZE - 1;
+    static const int INT_WAKE_ALL = 0x7fffffff;
+
+    struct Cell {
+        size_t m_seq;
+        void*  m_task;
+    } __attribute__((aligned(CDB_CACHE_LINE)));
+
+private:
+    void notify() {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&m_waiters, __ATOMIC_RELAXED) == 0) return;
+        __atomic_add_fetch(&m_signal, 1, __ATOMIC_SEQ_CST);
+        Futex::wake(&m_signal, 1);
+    }
 
 private:
-    size_t m_start;
-    size_t m_count;
-    boost::mutex m_mutex;
-    boost::condition m_cond;
-    std::vector<void*> m_tasks;
+    Cell   m_cells[QUEUE_SIZE];
+    size_t m_tail    __attribute__((aligned(CDB_CACHE_LINE)));
+    size_t m_head    __attribute__((aligned(CDB_CACHE_LINE)));
+    int    m_signal  __attribute__((aligned(CDB_CACHE_LINE)));
+    int    m_waiters;
 };
 
 } // namespace cdb